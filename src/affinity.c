@@ -0,0 +1,194 @@
+/**
+ * Core and NUMA placement for fill_ringbuffer
+ *
+ * The NUMA system calls are used directly, so we do not depend on libnuma.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "affinity.h"
+
+/**
+ * Parse a list of cores in the format of the kernel, for example "0-3,8,10-11"
+ *
+ * @param {char *} list The list
+ * @param {int *} cores Array to store the cores in
+ * @param {int} max Size of the array
+ * @returns {int} The number of cores, or -1 for an invalid list
+ */
+int parse_cpulist(const char *list, int *cores, int max) {
+  const char *p = list;
+  char *end;
+  long first, last, c;
+  int n = 0;
+
+  while (*p && *p != '\n') {
+    first = strtol(p, &end, 10);
+    if (end == p || first < 0) {
+      return -1;
+    }
+    last = first;
+    p = end;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return -1;
+      }
+      p = end;
+    }
+    for (c = first; c <= last && n < max; c++) {
+      cores[n++] = c;
+    }
+    if (*p == ',') {
+      p++;
+    } else if (*p && *p != '\n') {
+      return -1;
+    }
+  }
+  return n;
+}
+
+/**
+ * Get the cores this process is allowed to run on
+ *
+ * @param {int *} cores Array to store the cores in
+ * @param {int} max Size of the array
+ * @returns {int} The number of cores, or 0 when unknown
+ */
+int allowed_cores(int *cores, int max) {
+  cpu_set_t cpuset;
+  int n = 0;
+  int i;
+
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) != 0) {
+    return 0;
+  }
+  for (i = 0; i < CPU_SETSIZE && n < max; i++) {
+    if (CPU_ISSET(i, &cpuset)) {
+      cores[n++] = i;
+    }
+  }
+  return n;
+}
+
+/**
+ * Get the cores of a NUMA node, that this process is allowed to run on
+ *
+ * @param {int} node The NUMA node
+ * @param {int *} cores Array to store the cores in
+ * @param {int} max Size of the array
+ * @returns {int} The number of cores, or 0 when unknown
+ */
+int node_cores(int node, int *cores, int max) {
+  char filename[256];
+  char list[4096];
+  cpu_set_t cpuset;
+  FILE *f;
+  int n, i, m = 0;
+
+  snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%i/cpulist", node);
+  f = fopen(filename, "r");
+  if (!f) {
+    return 0;
+  }
+  if (!fgets(list, sizeof(list), f)) {
+    list[0] = '\0';
+  }
+  fclose(f);
+
+  n = parse_cpulist(list, cores, max);
+  if (n <= 0 || sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) != 0) {
+    return n < 0 ? 0 : n;
+  }
+  for (i = 0; i < n; i++) {
+    if (cores[i] < CPU_SETSIZE && CPU_ISSET(cores[i], &cpuset)) {
+      cores[m++] = cores[i];
+    }
+  }
+  return m;
+}
+
+/**
+ * Find the NUMA node of a network interface, from /sys/class/net/<interface>/device/numa_node
+ *
+ * @param {char *} interface Name of the interface
+ * @returns {int} The NUMA node, or -1 when unknown (virtual interfaces, or single node systems)
+ */
+int nic_numa_node(const char *interface) {
+  char filename[256];
+  FILE *f;
+  int node = -1;
+
+  snprintf(filename, sizeof(filename), "/sys/class/net/%s/device/numa_node", interface);
+  f = fopen(filename, "r");
+  if (!f) {
+    return -1;
+  }
+  if (fscanf(f, "%i", &node) != 1) {
+    node = -1;
+  }
+  fclose(f);
+  return node;
+}
+
+/**
+ * Find the NUMA node of the memory page at an address; the page should be faulted in
+ *
+ * @param {void *} addr The address
+ * @returns {int} The NUMA node, or -1 when unknown
+ */
+int memory_numa_node(void *addr) {
+  int node = -1;
+
+  if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+    return -1;
+  }
+  return node;
+}
+
+/**
+ * Bind memory to a NUMA node, and move the pages already on another node
+ * Only pages mapped by this process alone can be moved
+ *
+ * @param {void *} addr Start of the memory, aligned to a page
+ * @param {size_t} len Length of the memory
+ * @param {int} node The NUMA node
+ * @returns {int} 0 on success, -1 on failure
+ */
+int bind_memory(void *addr, size_t len, int node) {
+  unsigned long nodemask[16];
+
+  if (node < 0 || node >= 16 * 8 * sizeof(unsigned long)) {
+    return -1;
+  }
+  memset(nodemask, 0, sizeof(nodemask));
+  nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+  return syscall(SYS_mbind, addr, len, MPOL_BIND, nodemask, 16 * 8 * sizeof(unsigned long), MPOL_MF_MOVE) == 0 ? 0 : -1;
+}
+
+/**
+ * Pin a thread to a core
+ *
+ * @param {pthread_t} thread The thread
+ * @param {int} core The core, or -1 to leave the thread unpinned
+ * @returns {int} 0 on success, -1 on failure
+ */
+int pin_thread(pthread_t thread, int core) {
+  cpu_set_t cpuset;
+
+  if (core < 0) {
+    return 0;
+  }
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) == 0 ? 0 : -1;
+}
@@ -0,0 +1,21 @@
+/**
+ * Core and NUMA placement for fill_ringbuffer
+ *
+ * The receive threads, the NIC and the dada ringbuffer should be on the same NUMA node;
+ * copies across the node interconnect cost bandwidth and cause packet loss.
+ */
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+int parse_cpulist(const char *list, int *cores, int max);
+int allowed_cores(int *cores, int max);
+int node_cores(int node, int *cores, int max);
+int nic_numa_node(const char *interface);
+int memory_numa_node(void *addr);
+int bind_memory(void *addr, size_t len, int node);
+int pin_thread(pthread_t thread, int core);
+
+#endif
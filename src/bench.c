@@ -0,0 +1,382 @@
+/**
+ * micro-benchmarks for the hot paths of fill_ringbuffer; used for development
+ *
+ * Benchmarks:
+ *  - fill: overwrite the payloads of missing packets in a page, for 1%, 10% and 50% random packet loss
+ *  - copy: copy payloads from a batch of packets to a page in random order, for each copy kernel
+ *  - headers: validate the headers of batches of packets, one at a time and with validate_headers
+ *
+ * With -T Stokes IQUV pages are transposed, and the copy benchmark also times transpose_iquv.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <byteswap.h>
+
+#include "fill_ringbuffer.h"
+#include "fill_missing.h"
+#include "stream_copy.h"
+#include "transpose.h"
+#include "validate.h"
+#include "modes.h"
+
+#define PAGETIME 1024.0            // Time span of a ringbuffer page in ms
+
+FILE *runlog = NULL;
+
+void clean_exit(int signum) {
+  exit(EXIT_FAILURE);
+}
+
+/**
+ * Print commandline optinos
+ */
+void printOptions() {
+  printf("usage: bench -b <benchmark> -c <science case> -m <science mode> [-n <iterations>] [-P <padded size>] [-T]\n");
+  printf("e.g. bench -b fill -c 4 -m 0\n");
+  printf("Benchmarks: fill, copy, headers\n");
+  return;
+}
+
+/**
+ * Parse commandline
+ */
+void parseOptions(int argc, char*argv[], char **benchmark, int *science_case, int *science_mode, int *iterations, int *padded_size, int *transpose) {
+  int setb=0, setc=0, setm=0;
+
+  int c;
+  while((c=getopt(argc,argv,"b:c:m:n:P:T"))!=-1) {
+    switch(c) {
+      // -b benchmark
+      case('b'):
+        *benchmark = strdup(optarg);
+        setb=1;
+        break;
+
+      // -c case
+      case('c'):
+        *science_case = atoi(optarg);
+        setc=1;
+        if (*science_case < 3 || *science_case > 4) {
+          printOptions();
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -m mode
+      case('m'):
+        *science_mode = atoi(optarg);
+        setm=1;
+        if (*science_mode < 0 || *science_mode > 3) {
+          printOptions();
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -n iterations
+      case('n'):
+        *iterations = atoi(optarg);
+        break;
+
+      // -P padded size
+      case('P'):
+        *padded_size = atoi(optarg);
+        break;
+
+      // -T transpose Stokes IQUV
+      case('T'):
+        *transpose = 1;
+        break;
+
+      default:
+        printOptions();
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  // All arguments are required
+  if (!setb || !setc || !setm) {
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Wall clock time in ms
+ */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+/**
+ * Time fill_missing on a full page, for a few packet loss fractions
+ *
+ * @param {page_layout_t *} layout Layout of the page
+ * @param {size_t} page_size Size of the page in bytes
+ * @param {int} iterations Number of fills per loss fraction
+ */
+void bench_fill(page_layout_t *layout, size_t page_size, int iterations) {
+  float losses[] = {0.01, 0.10, 0.50};
+  int nwords = (layout->nslots + 63) / 64;
+  unsigned long *arrived;
+  char *page;
+  double start, elapsed;
+  long nfilled;
+  int l, i, s;
+
+  page = aligned_alloc(4096, page_size);
+  arrived = malloc(nwords * sizeof(unsigned long));
+
+  // fault in the page
+  memset(page, 1, page_size);
+
+  printf("%-6s %12s %12s %12s %10s\n", "loss", "slots", "ms/page", "GB/s", "page time");
+  for (l = 0; l < sizeof(losses) / sizeof(float); l++) {
+    // random loss pattern
+    srand(42);
+    memset(arrived, 0, nwords * sizeof(unsigned long));
+    for (s = 0; s < layout->nslots; s++) {
+      if (rand() >= losses[l] * RAND_MAX) {
+        arrived[s / 64] |= 1UL << (s % 64);
+      }
+    }
+
+    nfilled = 0;
+    elapsed = 0;
+    for (i = 0; i < iterations; i++) {
+      start = now();
+      nfilled = fill_missing(page, arrived, layout, 0);
+      elapsed += now() - start;
+    }
+    elapsed /= iterations;
+
+    printf("%5.1f%% %12li %12.3f %12.2f %9.2f%%\n", 100.0 * losses[l], nfilled, elapsed,
+        nfilled * layout->payload_size / (elapsed * 1e6), 100.0 * elapsed / PAGETIME);
+  }
+
+  free(arrived);
+  free(page);
+}
+
+/**
+ * Time filling a full page with the payloads of a batch of packets, using each copy kernel
+ * The packets arrive in random order, and the batch buffer is reused as in the recvmmsg backend.
+ *
+ * @param {page_layout_t *} layout Layout of the page
+ * @param {size_t} page_size Size of the page in bytes
+ * @param {int} iterations Number of pages per kernel
+ */
+void bench_copy(page_layout_t *layout, size_t page_size, int iterations) {
+  stream_copy_t copy;
+  packet_t *packets;
+  char *page;
+  int *order;
+  double start, elapsed;
+  int kernel, i, s, t;
+
+  page = aligned_alloc(4096, page_size);
+  packets = malloc(MMSG_VLEN * sizeof(packet_t));
+  order = malloc(layout->nslots * sizeof(int));
+
+  // fault in the page and the packets
+  memset(page, 1, page_size);
+  memset(packets, 2, MMSG_VLEN * sizeof(packet_t));
+
+  // random arrival order
+  srand(42);
+  for (s = 0; s < layout->nslots; s++) {
+    order[s] = s;
+  }
+  for (s = layout->nslots - 1; s > 0; s--) {
+    i = rand() % (s + 1);
+    t = order[s]; order[s] = order[i]; order[i] = t;
+  }
+
+  printf("%-8s %12s %12s %10s\n", "kernel", "ms/page", "GB/s", "page time");
+  for (kernel = layout->transposed ? -1 : STREAM_COPY_MEMCPY; kernel <= STREAM_COPY_AVX512; kernel++) {
+    if (kernel == -1) {
+      // transposed placement
+      elapsed = 0;
+      for (i = 0; i < iterations; i++) {
+        start = now();
+        for (s = 0; s < layout->nslots; s++) {
+          t = order[s];
+          transpose_iquv(page + ((t / layout->sequence_length / (NCHANNELS / 4)) * 4 * NCHANNELS + (t / layout->sequence_length % (NCHANNELS / 4)) * 4) * layout->sequence_length * IQUV_SAMPLES
+              + (t % layout->sequence_length) * IQUV_SAMPLES, packets[s % MMSG_VLEN].record,
+              NCHANNELS * layout->sequence_length * IQUV_SAMPLES, layout->sequence_length * IQUV_SAMPLES);
+        }
+        stream_fence();
+        elapsed += now() - start;
+      }
+      elapsed /= iterations;
+
+      printf("%-8s %12.3f %12.2f %9.2f%%\n", "transpose", elapsed,
+          layout->nslots * layout->payload_size / (elapsed * 1e6), 100.0 * elapsed / PAGETIME);
+      continue;
+    }
+    if (!stream_copy_supported(kernel)) {
+      printf("%-8s %12s\n", stream_copy_name(kernel), "unsupported");
+      continue;
+    }
+    copy = stream_copy_get(kernel);
+
+    elapsed = 0;
+    for (i = 0; i < iterations; i++) {
+      start = now();
+      for (s = 0; s < layout->nslots; s++) {
+        t = order[s];
+        copy(page + (t / layout->sequence_length) * layout->row_size + (t % layout->sequence_length) * layout->payload_size,
+            packets[s % MMSG_VLEN].record, layout->payload_size);
+      }
+      stream_fence();
+      elapsed += now() - start;
+    }
+    elapsed /= iterations;
+
+    printf("%-8s %12.3f %12.2f %9.2f%%\n", stream_copy_name(kernel), elapsed,
+        layout->nslots * layout->payload_size / (elapsed * 1e6), 100.0 * elapsed / PAGETIME);
+  }
+
+  free(order);
+  free(packets);
+  free(page);
+}
+
+/**
+ * Time a batch validation function
+ */
+static void bench_validate(const char *name,
+    uint64_t (*validate)(const header_check_t *, packet_t * const *, int, unsigned long *, unsigned short *),
+    header_check_t *check, packet_t **packets, long nbatches) {
+  unsigned long timestamps[MMSG_VLEN];
+  unsigned short channels[MMSG_VLEN];
+  double start, elapsed;
+  long nvalid = 0;
+  long b;
+  int i;
+
+  start = now();
+  for (b = 0; b < nbatches; b++) {
+    for (i = 0; i < MMSG_VLEN; i += VALIDATE_BATCH) {
+      nvalid += __builtin_popcountl(validate(check, &packets[i], VALIDATE_BATCH, &timestamps[i], &channels[i]));
+    }
+    __asm__ volatile("" : : "r" (timestamps), "r" (channels) : "memory");
+  }
+  elapsed = now() - start;
+  printf("%-10s %12.3f %12li\n", name, 1e6 * elapsed / (nbatches * MMSG_VLEN), nvalid);
+}
+
+/**
+ * Time validating the headers of a batch of MMSG_VLEN packets, per packet and per batch
+ *
+ * @param {page_layout_t *} layout Layout of the page
+ * @param {int} science_case Science case
+ * @param {int} science_mode Science mode
+ * @param {int} iterations Number of batches, in thousands
+ */
+void bench_headers(page_layout_t *layout, int science_case, int science_mode, int iterations) {
+  unsigned char marker_byte = 0xd0 + (science_case == 4 ? 0x10 : 0) + science_mode;
+  unsigned char cb_index = 7;
+  int ntabs = layout->nslots / layout->sequence_length / ((science_mode & 1) ? NCHANNELS / 4 : NCHANNELS);
+  unsigned long timestamps[MMSG_VLEN];
+  unsigned short channels[MMSG_VLEN];
+  header_check_t check;
+  packet_t *packet_buffer;
+  packet_t *packets[MMSG_VLEN];
+  double start, elapsed;
+  long nvalid, nbatches = 1000L * iterations;
+  long b;
+  int i;
+
+  header_check_init(&check, marker_byte, cb_index, layout->payload_size, ntabs, layout->sequence_length);
+
+  // a batch of valid packets, in the order of the sender
+  packet_buffer = malloc(MMSG_VLEN * sizeof(packet_t));
+  for (i = 0; i < MMSG_VLEN; i++) {
+    packet_t *packet = &packet_buffer[i];
+    memset(packet, 0, APPHEADER);
+    packet->marker_byte = marker_byte;
+    packet->format_version = 1;
+    packet->cb_index = cb_index;
+    packet->tab_index = i % ntabs;
+    packet->channel_index = bswap_16((i / ntabs) % NCHANNELS);
+    packet->payload_size = bswap_16(layout->payload_size);
+    packet->timestamp = bswap_64(1600000UL);
+    packet->sequence_number = i % layout->sequence_length;
+    packets[i] = packet;
+  }
+
+  printf("%-10s %12s %12s\n", "path", "ns/packet", "valid");
+
+  nvalid = 0;
+  start = now();
+  for (b = 0; b < nbatches; b++) {
+    for (i = 0; i < MMSG_VLEN; i++) {
+      if (check_header(&check, packets[i]) < 0) {
+        timestamps[i] = bswap_64(packets[i]->timestamp);
+        channels[i] = bswap_16(packets[i]->channel_index);
+        nvalid++;
+      }
+    }
+    __asm__ volatile("" : : "r" (timestamps), "r" (channels) : "memory");
+  }
+  elapsed = now() - start;
+  printf("%-10s %12.3f %12li\n", "per packet", 1e6 * elapsed / (nbatches * MMSG_VLEN), nvalid);
+
+  bench_validate("scalar", validate_headers_scalar, &check, packets, nbatches);
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    bench_validate("avx512", validate_headers_avx512, &check, packets, nbatches);
+  } else {
+    printf("%-10s %12s\n", "avx512", "unsupported");
+  }
+
+  free(packet_buffer);
+}
+
+int main(int argc, char *argv[]) {
+  char *benchmark = NULL;
+  int science_case;
+  int science_mode;
+  int iterations = 10;
+  int transpose = 0;
+  int padded_size = STOKESI_ROW_SIZE;
+  size_t page_size;
+  page_layout_t layout;
+  const science_mode_t *mode;
+
+  parseOptions(argc, argv, &benchmark, &science_case, &science_mode, &iterations, &padded_size, &transpose);
+
+  // page layout, see fill_ringbuffer
+  mode = science_mode_lookup(science_case, science_mode);
+  layout.sequence_length = mode->sequence_length;
+  layout.payload_size = mode->payload_size;
+  layout.nslots = mode->nslots;
+  layout.row_size = science_mode_row_size(mode, padded_size);
+  layout.transposed = (science_mode & 1) ? transpose : 0;
+  page_size = science_mode_page_size(mode, padded_size);
+  // transpose_iquv streams with the default copy kernel
+  stream_copy_init(STREAM_COPY_AUTO);
+
+  printf("Science case %i, mode %i: %i packets, page size %lu bytes\n", science_case, science_mode, layout.nslots, page_size);
+
+  if (strcmp(benchmark, "fill") == 0) {
+    bench_fill(&layout, page_size, iterations);
+  } else if (strcmp(benchmark, "copy") == 0) {
+    bench_copy(&layout, page_size, iterations);
+  } else if (strcmp(benchmark, "headers") == 0) {
+    bench_headers(&layout, science_case, science_mode, iterations);
+  } else {
+    fprintf(stderr, "Unknown benchmark '%s'\n", benchmark);
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+
+  free(benchmark);
+  exit(EXIT_SUCCESS);
+}
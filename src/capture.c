@@ -0,0 +1,527 @@
+/**
+ * Packet capture backends for fill_ringbuffer: common part and the recvmmsg backend
+ *
+ */
+// needed for GNU extension to recvfrom: recvmmsg
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <linux/mman.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+
+#include "capture.h"
+
+/**
+ * Allocate a receive buffer on hugepages, to save TLB misses when scattering packets
+ * Tries 1 GB pages for buffers of 1 GB or more, then 2 MB pages, and falls back to
+ * transparent hugepages when none are reserved. The buffer is prefaulted.
+ *
+ * @param {size_t} size Size of the buffer in bytes
+ * @returns {void *} The buffer, or NULL on failure
+ */
+void *alloc_hugepages(size_t size) {
+  static int warned = 0;
+  size_t huge_size;
+  void *buf;
+
+  if (size >= (1UL << 30)) {
+    huge_size = (size + (1UL << 30) - 1) & ~((1UL << 30) - 1);
+    buf = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB | MAP_POPULATE, -1, 0);
+    if (buf != MAP_FAILED) {
+      return buf;
+    }
+  }
+
+  huge_size = (size + (1UL << 21) - 1) & ~((1UL << 21) - 1);
+  buf = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB | MAP_POPULATE, -1, 0);
+  if (buf != MAP_FAILED) {
+    return buf;
+  }
+
+  if (!warned) {
+    LOG("Warning: no hugepages reserved for the receive buffers, using transparent hugepages\n");
+    warned = 1;
+  }
+  buf = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    return NULL;
+  }
+  madvise(buf, huge_size, MADV_HUGEPAGE);
+  memset(buf, 0, huge_size);
+  return buf;
+}
+
+/**
+ * Open a socket to read from a network port
+ *
+ * @param {int} port Network port to connect to
+ * @param {int} reuseport Set SO_REUSEPORT, so multiple sockets can bind to the same port
+ * @returns {int} socket file descriptor
+ */
+int init_network(int port, int reuseport) {
+  int sock;
+  struct addrinfo hints, *servinfo, *p;
+  char service[256];
+
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET; // set to AF_INET to force IPv4
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE; // use my IP
+
+  snprintf(service, 255, "%i", port);
+  if (getaddrinfo(NULL, service, &hints, &servinfo) != 0) {
+    perror(NULL);
+    exit(EXIT_FAILURE);
+  }
+
+  for(p = servinfo; p != NULL; p = p->ai_next) {
+    sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (sock == -1) {
+      perror(NULL);
+      continue;
+    }
+
+    // set socket buffer size
+    int sockbufsize = SOCKBUFSIZE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sockbufsize, (socklen_t)sizeof(int));
+
+    // report the number of packets dropped by the socket with every received packet
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, (socklen_t)sizeof(int));
+
+    // do not block forever when the stream stops, so the receivers can end the observation
+    struct timeval rcvtimeo = {CAPTURE_TIMEOUT / 1000, (CAPTURE_TIMEOUT % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcvtimeo, (socklen_t)sizeof(rcvtimeo));
+
+    // allow other receiver threads to bind to the same port
+    if (reuseport) {
+      if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, (socklen_t)sizeof(int)) == -1) {
+        perror("SO_REUSEPORT");
+        close(sock);
+        continue;
+      }
+    }
+
+    if(bind(sock, p->ai_addr, p->ai_addrlen) == -1) {
+      perror(NULL);
+      close(sock);
+      continue;
+    }
+
+    // set up, break the loop
+    break;
+  }
+
+  if (p == NULL) {
+    fprintf(stderr, "Cannot setup connection\n" );
+    exit(EXIT_FAILURE);
+  }
+
+  free(servinfo);
+
+  return sock;
+}
+
+/**
+ * Check that the kernel granted the SOCKBUFSIZE socket buffer; it silently limits it to net.core.rmem_max
+ *
+ * @param {int} sock The socket
+ */
+static void check_rcvbuf(int sock) {
+  int sockbufsize = 0;
+  socklen_t len = sizeof(int);
+
+  if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sockbufsize, &len) == -1) {
+    LOG("Warning: cannot get the socket buffer size: %s\n", strerror(errno));
+    return;
+  }
+
+  // the kernel doubles the requested size, to account for its bookkeeping
+  if (sockbufsize < 2 * SOCKBUFSIZE) {
+    LOG("Warning: socket buffer is %i MB instead of %i MB; raise net.core.rmem_max to at least %i\n",
+        sockbufsize / 2 >> 20, SOCKBUFSIZE >> 20, SOCKBUFSIZE);
+  } else {
+    LOG("Socket buffer is %i MB\n", sockbufsize / 2 >> 20);
+  }
+}
+
+/**
+ * Distribute packets over the sockets in a SO_REUSEPORT group by channel
+ *
+ * Without a filter the kernel selects the socket by hashing the sender's address and port,
+ * which sends all packets from a single sender to the same thread.
+ * The classic BPF program below sees the UDP payload, ie. our packet header, and returns
+ * the socket index: (channel_index / 4) modulo the number of sockets.
+ *
+ * @param {int} sock Any socket from the group
+ * @param {int} nsockets Number of sockets in the group, in order of binding
+ */
+void init_reuseport_filter(int sock, int nsockets) {
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 4),        // A = channel_index (network byte order)
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K,   2),        // A = A / 4, IQUV packets carry four channels
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,   nsockets), // A = A % nsockets
+    BPF_STMT(BPF_RET | BPF_A,             0)
+  };
+  struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+    LOG("Warning: cannot attach reuseport filter, using kernel flow hashing\n");
+  }
+}
+
+/**
+ * Parse the name of a capture backend
+ *
+ * @param {const char *} name Name of the backend
+ * @returns {int} The backend, or -1 for an unknown name
+ */
+int capture_backend(const char *name) {
+  if (strcmp(name, "recvmmsg") == 0) {
+    return CAPTURE_RECVMMSG;
+  } else if (strcmp(name, "tpacket") == 0) {
+    return CAPTURE_TPACKET;
+  } else if (strcmp(name, "uring") == 0) {
+    return CAPTURE_URING;
+  } else if (strcmp(name, "file") == 0) {
+    return CAPTURE_FILE;
+  }
+  return -1;
+}
+
+/**
+ * Name of a capture backend
+ *
+ * @param {int} backend The backend
+ * @returns {const char *} Its name
+ */
+const char *capture_backend_name(int backend) {
+  switch (backend) {
+    case CAPTURE_RECVMMSG: return "recvmmsg";
+    case CAPTURE_TPACKET: return "tpacket";
+    case CAPTURE_URING: return "uring";
+    case CAPTURE_FILE: return "file";
+    default: return "unknown";
+  }
+}
+
+/**
+ * Open a packet capture
+ * Multiple captures can share a port, packets are then distributed over the captures by channel.
+ *
+ * @param {capture_t *} cap The capture to open
+ * @param {int} backend One of CAPTURE_RECVMMSG, CAPTURE_TPACKET, CAPTURE_URING
+ * @param {const char *} interface Network interface to capture on, only used by the tpacket backend; the pcap file to read for the file backend
+ * @param {int} port UDP port to receive on
+ * @param {size_t} packet_size Expected size of the UDP payload
+ * @param {int} index Index of this capture among the ones sharing the port
+ * @param {int} nsockets Number of captures sharing the port
+ */
+void capture_open(capture_t *cap, int backend, const char *interface, int port, size_t packet_size, int index, int nsockets) {
+  unsigned int packet_idx;
+
+  memset(cap, 0, sizeof(capture_t));
+  cap->backend = backend;
+  cap->port = port;
+  cap->sample = 1;
+  cap->packet_size = packet_size;
+  cap->sockfd = -1;
+  cap->sinkfd = -1;
+
+  if (backend == CAPTURE_TPACKET) {
+    capture_open_tpacket(cap, interface, port, index, nsockets);
+    return;
+  } else if (backend == CAPTURE_FILE) {
+    capture_open_file(cap, interface, index);
+    return;
+  } else if (backend == CAPTURE_URING) {
+    capture_open_uring(cap, port, index, nsockets);
+    if (index == 0) {
+      check_rcvbuf(cap->sockfd);
+    }
+    return;
+  }
+
+  cap->sockfd = init_network(port, nsockets > 1);
+  if (nsockets > 1 && index == 0) {
+    init_reuseport_filter(cap->sockfd, nsockets);
+  }
+  if (index == 0) {
+    check_rcvbuf(cap->sockfd);
+  }
+
+  cap->packet_buffer = alloc_hugepages(MMSG_VLEN * sizeof(packet_t));
+  cap->iov = malloc(MMSG_VLEN * sizeof(struct iovec));
+  cap->msgs = malloc(MMSG_VLEN * sizeof(struct mmsghdr));
+  cap->packets = malloc(MMSG_VLEN * sizeof(packet_t *));
+  cap->control = malloc(MMSG_VLEN * CAPTURE_CONTROL);
+  cap->arrival = calloc(MMSG_VLEN, sizeof(unsigned long));
+  if (!cap->packet_buffer || !cap->iov || !cap->msgs || !cap->packets || !cap->control || !cap->arrival) {
+    LOG("ERROR: cannot allocate receive buffers\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // multi message setup
+  memset(cap->msgs, 0, MMSG_VLEN * sizeof(struct mmsghdr));
+  for(packet_idx=0; packet_idx < MMSG_VLEN; packet_idx++) {
+    cap->iov[packet_idx].iov_base = (char *) &cap->packet_buffer[packet_idx];
+    cap->iov[packet_idx].iov_len = packet_size;
+
+    cap->msgs[packet_idx].msg_hdr.msg_name    = NULL; // we don't need to know who sent the data
+    cap->msgs[packet_idx].msg_hdr.msg_iov     = &cap->iov[packet_idx];
+    cap->msgs[packet_idx].msg_hdr.msg_iovlen  = 1;
+    cap->msgs[packet_idx].msg_hdr.msg_control = &cap->control[packet_idx * CAPTURE_CONTROL]; // for the drop counter
+    cap->msgs[packet_idx].msg_hdr.msg_controllen = CAPTURE_CONTROL;
+
+    cap->packets[packet_idx] = &cap->packet_buffer[packet_idx];
+  }
+}
+
+/**
+ * Receive the next batch of packets; blocks till packets are available, or for at most CAPTURE_TIMEOUT milliseconds
+ * The packets are available as cap->packets[0 .. cap->npackets-1]
+ * Packets shorter than cap->packet_size are dropped by all backends, and counted in cap->short_packets
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {int} Number of packets in the batch, which can be zero, -1 on error, or CAPTURE_END at the end of a file
+ */
+int capture_next_batch(capture_t *cap) {
+  if (cap->backend == CAPTURE_TPACKET) {
+    return capture_next_batch_tpacket(cap);
+  } else if (cap->backend == CAPTURE_URING) {
+    return capture_next_batch_uring(cap);
+  } else if (cap->backend == CAPTURE_FILE) {
+    return capture_next_batch_file(cap);
+  }
+
+  // read new packets from the network into the buffer;
+  // while sampling, do not wait for a full batch.
+  // On the receive timeout the batch is partial, or empty
+  int flags = cap->sample > 1 ? MSG_WAITFORONE : 0;
+  int npackets = recvmmsg(cap->sockfd, cap->msgs, MMSG_VLEN, flags, NULL);
+  int i, n = 0;
+  if (npackets == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    cap->npackets = 0;
+    return 0;
+  }
+  if (npackets < 1) {
+    cap->npackets = 0;
+    return -1;
+  }
+
+  // the drop counter only increases, so without timestamps only the last packet is needed;
+  // the kernel sets msg_controllen to the length used, reset it for the next batch
+  if (cap->timestamps) {
+    for (i = 0; i < npackets; i++) {
+      cap->arrival[i] = capture_control(cap, cap->msgs[i].msg_hdr.msg_control, cap->msgs[i].msg_hdr.msg_controllen);
+    }
+  } else {
+    capture_control(cap, cap->msgs[npackets - 1].msg_hdr.msg_control, cap->msgs[npackets - 1].msg_hdr.msg_controllen);
+  }
+  for (i = 0; i < npackets; i++) {
+    cap->msgs[i].msg_hdr.msg_controllen = CAPTURE_CONTROL;
+  }
+
+  // compact the batch, dropping short packets; longer packets are truncated to packet_size
+  for (i = 0; i < npackets; i++) {
+    if (cap->msgs[i].msg_len < cap->packet_size) {
+      cap->short_packets++;
+      continue;
+    }
+    cap->arrival[n] = cap->arrival[i];
+    cap->packets[n++] = &cap->packet_buffer[i];
+  }
+
+  cap->npackets = n;
+  return cap->npackets;
+}
+
+/**
+ * Keep only a random sample of the packets, or all packets again
+ * The other packets are dropped by a BPF filter in the kernel, before they are copied to the socket or ring;
+ * this is used while idling before the start of an observation.
+ * Note that the kernel counts the packets dropped by the filter of a UDP socket as receive errors.
+ *
+ * @param {capture_t *} cap The capture
+ * @param {int} sample Keep one in this many packets, 1 to keep all
+ */
+void capture_idle(capture_t *cap, int sample) {
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM), // A = random number
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,   sample),                     // A = A % sample
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K,             0x40000),                    // keep the packet
+    BPF_STMT(BPF_RET | BPF_K,             0)                           // drop the packet
+  };
+  struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+  int unused = 0;
+  int result;
+
+  if (sample < 1) {
+    sample = 1;
+  }
+  if (sample == cap->sample || cap->backend == CAPTURE_FILE) {
+    // a file is always read in full, so a run is reproducible
+    return;
+  }
+
+  if (cap->backend == CAPTURE_TPACKET) {
+    result = capture_idle_tpacket(cap, sample);
+  } else if (sample > 1) {
+    result = setsockopt(cap->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+  } else {
+    result = setsockopt(cap->sockfd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+  }
+
+  if (result == -1) {
+    LOG("Warning: cannot change the packet sampling, keeping one in %i packets: %s\n", cap->sample, strerror(errno));
+    return;
+  }
+  cap->sample = sample;
+}
+
+/**
+ * Update the drop counter of a UDP capture from the control messages of a received packet, and get its receive time
+ * With SO_RXQ_OVFL the kernel attaches the number of packets the socket dropped so far, a 32-bit counter
+ * that is only sent once it is non-zero.
+ * With SO_TIMESTAMPING it attaches the software and the raw hardware receive time; the hardware time is preferred.
+ *
+ * @param {capture_t *} cap The capture; only the receiver thread should call this
+ * @param {void *} control Control messages of the packet
+ * @param {size_t} controllen Length of the control messages
+ * @returns {unsigned long} Receive time in ns since the epoch, 0 when unknown
+ */
+unsigned long capture_control(capture_t *cap, void *control, size_t controllen) {
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct scm_timestamping ts;
+  unsigned long arrival = 0;
+  unsigned long drops;
+  uint32_t count;
+
+  memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_control = control;
+  msg.msg_controllen = controllen;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(&count, CMSG_DATA(cmsg), sizeof(uint32_t));
+
+      // extend the counter to 64 bits
+      drops = atomic_load_explicit(&cap->drops, memory_order_relaxed);
+      atomic_store_explicit(&cap->drops, drops + (uint32_t) (count - (uint32_t) drops), memory_order_relaxed);
+    } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(struct scm_timestamping));
+      if (ts.ts[2].tv_sec) {
+        arrival = ts.ts[2].tv_sec * 1000000000UL + ts.ts[2].tv_nsec;
+      } else {
+        arrival = ts.ts[0].tv_sec * 1000000000UL + ts.ts[0].tv_nsec;
+      }
+    }
+  }
+  return arrival;
+}
+
+/**
+ * Let the network interface timestamp all received packets in hardware
+ * This needs CAP_NET_ADMIN, and a NIC that supports it.
+ *
+ * @param {const char *} interface The network interface
+ * @returns {int} 0 on success, -1 on error
+ */
+int capture_hw_timestamps(const char *interface) {
+  struct hwtstamp_config config;
+  struct ifreq ifr;
+  int sock, result;
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock == -1) {
+    return -1;
+  }
+
+  memset(&config, 0, sizeof(config));
+  config.tx_type = HWTSTAMP_TX_OFF;
+  config.rx_filter = HWTSTAMP_FILTER_ALL;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+  ifr.ifr_data = (char *) &config;
+
+  result = ioctl(sock, SIOCSHWTSTAMP, &ifr);
+  close(sock);
+  return result == -1 || config.rx_filter == HWTSTAMP_FILTER_NONE ? -1 : 0;
+}
+
+/**
+ * Enable receive timestamps on a capture
+ *
+ * @param {capture_t *} cap The capture
+ * @param {int} timestamps TIMESTAMPS_SOFTWARE, or TIMESTAMPS_HARDWARE to also ask for hardware timestamps
+ */
+void capture_timestamps(capture_t *cap, int timestamps) {
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  int result;
+
+  if (timestamps == TIMESTAMPS_HARDWARE) {
+    flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+  }
+
+  if (cap->backend == CAPTURE_TPACKET) {
+    result = capture_timestamps_tpacket(cap, flags);
+  } else if (cap->backend == CAPTURE_FILE) {
+    // the arrival times recorded in the file
+    result = 0;
+  } else {
+    result = setsockopt(cap->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+  }
+
+  if (result == -1) {
+    LOG("Warning: cannot enable receive timestamps: %s\n", strerror(errno));
+    return;
+  }
+  cap->timestamps = timestamps;
+}
+
+/**
+ * Number of packets dropped by the kernel since the capture was opened, because the socket buffer or ring was full
+ * For UDP sockets this includes the packets dropped by the sampling filter of capture_idle.
+ * Can be called from any thread; for UDP sockets no system call is needed.
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {unsigned long} Number of dropped packets
+ */
+unsigned long capture_drops(capture_t *cap) {
+  if (cap->backend == CAPTURE_TPACKET) {
+    return capture_drops_tpacket(cap);
+  }
+  return atomic_load_explicit(&cap->drops, memory_order_relaxed);
+}
+
+/**
+ * Hand the current batch back to the backend; the packets should not be used anymore
+ *
+ * @param {capture_t *} cap The capture
+ */
+void capture_release_batch(capture_t *cap) {
+  if (cap->backend == CAPTURE_TPACKET) {
+    capture_release_batch_tpacket(cap);
+  } else if (cap->backend == CAPTURE_URING) {
+    capture_release_batch_uring(cap);
+  } else if (cap->backend == CAPTURE_FILE) {
+    capture_release_batch_file(cap);
+  }
+  cap->npackets = 0;
+}
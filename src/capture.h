@@ -0,0 +1,111 @@
+/**
+ * Packet capture backends for fill_ringbuffer
+ *
+ * A backend delivers packets in batches; the packets stay valid until the batch is released.
+ *  - recvmmsg: UDP socket, packets are copied by the kernel to a buffer using recvmmsg()
+ *  - tpacket:  AF_PACKET socket with a memory mapped TPACKET_V3 ring, packets are parsed in place
+ *  - uring:    UDP socket read by an io_uring multishot recvmsg into a ring of provided buffers
+ *  - file:     pcap file, memory mapped, packets are handed out in place as fast as they are processed
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+#include "fill_ringbuffer.h"
+
+#define CAPTURE_RECVMMSG 0
+#define CAPTURE_TPACKET  1
+#define CAPTURE_URING    2
+#define CAPTURE_FILE     3
+
+#define CAPTURE_END      -2           // capture_next_batch: the end of the file was reached
+#define CAPTURE_TIMEOUT  100          // capture_next_batch: return an empty batch when no packets arrive for this many milliseconds
+
+#define TPACKET_BLOCKSIZE (1 << 22)   // Size of a block in the TPACKET_V3 ring in bytes
+#define TPACKET_NBLOCKS   64          // Number of blocks in the TPACKET_V3 ring
+#define TPACKET_TIMEOUT   10          // Retire a partially filled block after this many milliseconds
+
+#define URING_NBUFS 4096              // Number of provided buffers for io_uring, a power of two
+
+#define TIMESTAMPS_OFF      0
+#define TIMESTAMPS_SOFTWARE 1
+#define TIMESTAMPS_HARDWARE 2
+
+// Size of the control message buffer: SO_RXQ_OVFL drop counter and SO_TIMESTAMPING receive timestamps
+#define CAPTURE_CONTROL (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct scm_timestamping)))
+
+struct uring_state;
+struct file_state;
+
+typedef struct {
+  int backend;                // CAPTURE_RECVMMSG, CAPTURE_TPACKET or CAPTURE_URING
+  int sockfd;                 // Socket to receive from
+  int port;                   // UDP port to receive on
+  int sample;                 // Keep one in this many packets, 1 to keep all
+  atomic_ulong drops;         // Packets dropped by the kernel; UDP: as of the last received packet (SO_RXQ_OVFL)
+  int timestamps;             // Receive timestamps: TIMESTAMPS_OFF, TIMESTAMPS_SOFTWARE or TIMESTAMPS_HARDWARE
+  unsigned long *arrival;     // With timestamps: receive time of the packets in the current batch, in ns since the epoch
+  size_t packet_size;         // Expected size of the UDP payload: application header plus record
+  unsigned long short_packets; // Packets shorter than packet_size, dropped from the batches; reset by the caller
+
+  packet_t **packets;         // Current batch of packets
+  int npackets;               // Number of packets in the current batch
+
+  // recvmmsg
+  packet_t *packet_buffer;    // Buffer for batch requesting packets via recvmmsg
+  struct iovec *iov;          // IO vec structure for recvmmsg
+  struct mmsghdr *msgs;       // multimessage hearders for recvmmsg
+  char *control;              // Control message buffers for recvmmsg, CAPTURE_CONTROL bytes per message
+
+  // tpacket
+  int sinkfd;                 // UDP socket on the port, so the kernel does not answer with ICMP port unreachable
+  char *map;                  // Memory mapped ring
+  unsigned int block;         // Index of the current block in the ring
+  int block_in_use;           // Is the current block handed out as a batch
+
+  // io_uring
+  struct uring_state *uring;  // Rings and provided buffers
+  int nbids;                  // Number of provided buffers in the current batch
+
+  // file
+  struct file_state *file;    // Mapped pcap file, shared by the captures
+} capture_t;
+
+void *alloc_hugepages(size_t size);
+int init_network(int port, int reuseport);
+void init_reuseport_filter(int sock, int nsockets);
+
+int capture_backend(const char *name);
+const char *capture_backend_name(int backend);
+
+void capture_open(capture_t *cap, int backend, const char *interface, int port, size_t packet_size, int index, int nsockets);
+int capture_next_batch(capture_t *cap);
+void capture_release_batch(capture_t *cap);
+void capture_idle(capture_t *cap, int sample);
+unsigned long capture_drops(capture_t *cap);
+unsigned long capture_control(capture_t *cap, void *control, size_t controllen);
+int capture_hw_timestamps(const char *interface);
+void capture_timestamps(capture_t *cap, int timestamps);
+
+void capture_open_tpacket(capture_t *cap, const char *interface, int port, int index, int nsockets);
+int capture_next_batch_tpacket(capture_t *cap);
+void capture_release_batch_tpacket(capture_t *cap);
+int capture_idle_tpacket(capture_t *cap, int sample);
+unsigned long capture_drops_tpacket(capture_t *cap);
+int capture_timestamps_tpacket(capture_t *cap, int flags);
+
+void capture_open_uring(capture_t *cap, int port, int index, int nsockets);
+int capture_next_batch_uring(capture_t *cap);
+void capture_release_batch_uring(capture_t *cap);
+
+void capture_open_file(capture_t *cap, const char *filename, int index);
+int capture_next_batch_file(capture_t *cap);
+void capture_release_batch_file(capture_t *cap);
+void capture_report_file(capture_t *cap);
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * Packet capture backend for fill_ringbuffer reading a pcap file, for example one made with 'record'
+ *
+ * The file is memory mapped and read sequentially; the packets are handed out in place, without copies,
+ * as fast as the receivers process them. All captures of a run share the file: every batch is claimed
+ * from a shared position in the file, so the batches are spread over the receivers in file order.
+ * The receive times of the packets are the arrival times recorded in the file.
+ */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "capture.h"
+#include "pcap.h"
+
+/*
+ * A pcap file shared by the captures of a run
+ */
+struct file_state {
+  char *filename;
+  const unsigned char *map;           // Memory mapped file
+  size_t size;                        // Size of the file
+  unsigned long frac_ns;              // Length of a unit of ts_frac in ns
+  unsigned int linktype;              // Link type of the file
+
+  pthread_mutex_t lock;               // Protects the fields below
+  size_t offset;                      // Position of the next record
+  int busy;                           // Number of batches handed out and not yet released
+  unsigned long packets;              // Number of packets handed out
+  unsigned long skipped;              // Number of records that are not a packet of the expected size
+  struct timespec started;            // Time the first batch was handed out
+};
+
+static struct file_state *shared_file = NULL;
+
+/**
+ * Open a capture reading packets from a pcap file
+ * The first capture maps the file, the others share it.
+ *
+ * @param {capture_t *} cap The capture, with packet_size set
+ * @param {const char *} filename The pcap file
+ * @param {int} index Index of this capture among the ones sharing the file
+ */
+void capture_open_file(capture_t *cap, const char *filename, int index) {
+  struct file_state *f;
+  const char *error;
+
+  if (index == 0) {
+    f = calloc(1, sizeof(struct file_state));
+    if (!f) {
+      LOG("ERROR: cannot allocate the file state\n");
+      exit(EXIT_FAILURE);
+    }
+    f->map = pcap_map(filename, &f->size, &f->frac_ns, &error);
+    if (!f->map) {
+      LOG("ERROR: cannot read %s: %s\n", filename, error);
+      exit(EXIT_FAILURE);
+    }
+    f->filename = strdup(filename);
+    f->linktype = ((const pcap_header_t *) f->map)->linktype;
+    f->offset = sizeof(pcap_header_t);
+    pthread_mutex_init(&f->lock, NULL);
+    shared_file = f;
+  }
+  cap->file = shared_file;
+
+  cap->packets = malloc(MMSG_VLEN * sizeof(packet_t *));
+  cap->arrival = calloc(MMSG_VLEN, sizeof(unsigned long));
+  if (!cap->packets || !cap->arrival) {
+    LOG("ERROR: cannot allocate receive buffers\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Claim the next batch of packets from the file
+ * Records that are not an IPv4 UDP packet of at least the expected size are skipped.
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {int} Number of packets in the batch, zero while other captures still process the last batches,
+ *                or CAPTURE_END when the whole file has been processed
+ */
+int capture_next_batch_file(capture_t *cap) {
+  struct file_state *f = cap->file;
+  const pcap_record_t *record;
+  const unsigned char *payload;
+  size_t payload_len;
+  int npackets = 0;
+  int end;
+
+  pthread_mutex_lock(&f->lock);
+  if (f->packets == 0 && f->started.tv_sec == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &f->started);
+  }
+
+  while (npackets < MMSG_VLEN && f->offset + sizeof(pcap_record_t) <= f->size) {
+    record = (const pcap_record_t *) &f->map[f->offset];
+    if (f->offset + sizeof(pcap_record_t) + record->incl_len > f->size) {
+      LOG("Warning: %s is truncated\n", f->filename);
+      f->offset = f->size;
+      break;
+    }
+
+    payload = pcap_udp_payload(&f->map[f->offset + sizeof(pcap_record_t)], record->incl_len, f->linktype, &payload_len);
+    f->offset += sizeof(pcap_record_t) + record->incl_len;
+    if (!payload || payload_len < cap->packet_size) {
+      if (payload) {
+        cap->short_packets++;
+      }
+      f->skipped++;
+      continue;
+    }
+
+    cap->packets[npackets] = (packet_t *) payload;
+    cap->arrival[npackets] = record->ts_sec * 1000000000UL + record->ts_frac * f->frac_ns;
+    npackets++;
+  }
+
+  f->packets += npackets;
+  if (npackets) {
+    f->busy++;
+  }
+  end = npackets == 0 && f->busy == 0;
+  pthread_mutex_unlock(&f->lock);
+
+  cap->npackets = npackets;
+  return end ? CAPTURE_END : npackets;
+}
+
+/**
+ * Release the current batch
+ *
+ * @param {capture_t *} cap The capture
+ */
+void capture_release_batch_file(capture_t *cap) {
+  struct file_state *f = cap->file;
+
+  if (cap->npackets > 0) {
+    pthread_mutex_lock(&f->lock);
+    f->busy--;
+    pthread_mutex_unlock(&f->lock);
+  }
+}
+
+/**
+ * Log the number of packets read from the file, and the throughput
+ *
+ * @param {capture_t *} cap The capture
+ */
+void capture_report_file(capture_t *cap) {
+  struct file_state *f = cap->file;
+  struct timespec now;
+  double elapsed;
+
+  pthread_mutex_lock(&f->lock);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - f->started.tv_sec) + 1e-9 * (now.tv_nsec - f->started.tv_nsec);
+  LOG("Read %lu packets (%.3f GB) from %s in %.3f s: %.3f GB/s, skipped %lu records\n",
+      f->packets, 1e-9 * f->packets * cap->packet_size, f->filename, elapsed,
+      elapsed > 0 ? 1e-9 * f->packets * cap->packet_size / elapsed : 0.0, f->skipped);
+  pthread_mutex_unlock(&f->lock);
+}
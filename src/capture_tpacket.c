@@ -0,0 +1,281 @@
+/**
+ * Packet capture backend for fill_ringbuffer using a memory mapped AF_PACKET TPACKET_V3 ring
+ *
+ * The kernel fills blocks of the ring with the packets that pass a BPF filter on the UDP port;
+ * a block is handed out as one batch, with the packets parsed in place.
+ */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+
+#include "capture.h"
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+#ifndef PACKET_FANOUT_FLAG_IGNORE_OUTGOING
+#define PACKET_FANOUT_FLAG_IGNORE_OUTGOING 0x4000
+#endif
+
+#define ETH_IP_UDP_HEADER (14 + 20 + 8)   // Ethernet, IPv4 without options, and UDP header size
+
+/**
+ * Attach the filter of the ring: non-fragmented IPv4 UDP packets for our port, of which a random sample is kept
+ *
+ * @param {capture_t *} cap The capture
+ * @param {int} sample Keep one in this many packets, 1 to keep all
+ * @returns {int} 0 on success, -1 on error
+ */
+int capture_idle_tpacket(capture_t *cap, int sample) {
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 12),                // ethertype
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ETH_P_IP, 0, 11),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 23),                // IP protocol
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 9),
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 20),                // fragment offset
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  0x1fff, 7, 0),
+    BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 14),                // X = IP header length
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, 16),                // UDP destination port
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   cap->port, 0, 4),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,   sample),            // keep one in 'sample' packets
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K,             0x40000),
+    BPF_STMT(BPF_RET | BPF_K,             0)
+  };
+  struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+  return setsockopt(cap->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/**
+ * Open an AF_PACKET socket with a TPACKET_V3 ring receiving UDP packets for a port
+ *
+ * @param {capture_t *} cap The capture to open
+ * @param {const char *} interface Network interface to capture on
+ * @param {int} port UDP port to receive on
+ * @param {int} index Index of this capture among the ones sharing the port
+ * @param {int} nsockets Number of captures sharing the port, joined in a fanout group
+ */
+void capture_open_tpacket(capture_t *cap, const char *interface, int port, int index, int nsockets) {
+  struct sockaddr_ll addr;
+  struct tpacket_req3 req;
+  int version = TPACKET_V3;
+  int one = 1;
+  unsigned int max_packets;
+
+  if (!interface) {
+    fprintf(stderr, "The tpacket backend needs a network interface\n");
+    exit(EXIT_FAILURE);
+  }
+
+
+  cap->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (cap->sockfd == -1) {
+    perror("AF_PACKET socket");
+    exit(EXIT_FAILURE);
+  }
+
+  cap->port = port;
+  if (capture_idle_tpacket(cap, 1) == -1) {
+    perror("SO_ATTACH_FILTER");
+    exit(EXIT_FAILURE);
+  }
+
+  // on loopback every packet is seen twice, skip the outgoing copy
+  setsockopt(cap->sockfd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+  if (setsockopt(cap->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+    perror("PACKET_VERSION");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = TPACKET_BLOCKSIZE;
+  req.tp_block_nr = TPACKET_NBLOCKS;
+  req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+  req.tp_frame_nr = (TPACKET_BLOCKSIZE / req.tp_frame_size) * TPACKET_NBLOCKS;
+  req.tp_retire_blk_tov = TPACKET_TIMEOUT;
+  req.tp_feature_req_word = 0;
+  if (setsockopt(cap->sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+    perror("PACKET_RX_RING");
+    exit(EXIT_FAILURE);
+  }
+
+  cap->map = mmap(NULL, (size_t) TPACKET_BLOCKSIZE * TPACKET_NBLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, cap->sockfd, 0);
+  if (cap->map == MAP_FAILED) {
+    // MAP_LOCKED can fail on the memlock limit, retry without it
+    cap->map = mmap(NULL, (size_t) TPACKET_BLOCKSIZE * TPACKET_NBLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED, cap->sockfd, 0);
+  }
+  if (cap->map == MAP_FAILED) {
+    perror("mmap TPACKET ring");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = if_nametoindex(interface);
+  if (addr.sll_ifindex == 0) {
+    fprintf(stderr, "Unknown network interface %s\n", interface);
+    exit(EXIT_FAILURE);
+  }
+  if (bind(cap->sockfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    perror("bind AF_PACKET socket");
+    exit(EXIT_FAILURE);
+  }
+
+  // share the packets with the other captures, by channel as in init_reuseport_filter;
+  // the fanout program sees the packet starting at the IP header
+  if (nsockets > 1) {
+    int fanout = (port & 0xffff) | ((PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_IGNORE_OUTGOING) << 16);
+    struct sock_filter fanout_code[] = {
+      BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),                    // X = IP header length
+      BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, 8 + 4),                // A = channel_index
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K,   2),
+      BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,   nsockets),
+      BPF_STMT(BPF_RET | BPF_A,             0)
+    };
+    struct sock_fprog fanout_prog = { .len = sizeof(fanout_code) / sizeof(fanout_code[0]), .filter = fanout_code };
+
+    if (setsockopt(cap->sockfd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+      perror("PACKET_FANOUT");
+      exit(EXIT_FAILURE);
+    }
+    if (index == 0 && setsockopt(cap->sockfd, SOL_PACKET, PACKET_FANOUT_DATA, &fanout_prog, sizeof(fanout_prog)) == -1) {
+      LOG("Warning: cannot attach fanout filter\n");
+    }
+  }
+
+  // keep a UDP socket on the port, but drop everything it would receive
+  if (index == 0) {
+    struct sock_filter drop_code[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+    struct sock_fprog drop_prog = { .len = 1, .filter = drop_code };
+
+    cap->sinkfd = init_network(port, 0);
+    setsockopt(cap->sinkfd, SOL_SOCKET, SO_ATTACH_FILTER, &drop_prog, sizeof(drop_prog));
+  }
+
+  // room for the smallest possible frames filling a block
+  max_packets = TPACKET_BLOCKSIZE / (TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + ETH_IP_UDP_HEADER);
+  cap->packets = malloc(max_packets * sizeof(packet_t *));
+  cap->arrival = calloc(max_packets, sizeof(unsigned long));
+  if (!cap->packets || !cap->arrival) {
+    LOG("ERROR: cannot allocate receive buffers\n");
+    exit(EXIT_FAILURE);
+  }
+  cap->block = 0;
+  cap->block_in_use = 0;
+}
+
+/**
+ * Wait for the next block of the ring, for at most CAPTURE_TIMEOUT milliseconds, and collect its packets as a batch
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {int} Number of packets in the batch, which can be zero, or -1 on error
+ */
+int capture_next_batch_tpacket(capture_t *cap) {
+  struct tpacket_block_desc *block = (struct tpacket_block_desc *) (cap->map + (size_t) cap->block * TPACKET_BLOCKSIZE);
+  struct tpacket3_hdr *frame;
+  struct pollfd pfd;
+  unsigned int i;
+  int npackets = 0;
+
+  pfd.fd = cap->sockfd;
+  pfd.events = POLLIN | POLLERR;
+  pfd.revents = 0;
+
+  while ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+    switch (poll(&pfd, 1, CAPTURE_TIMEOUT)) {
+      case -1:
+        return -1;
+      case 0:
+        cap->npackets = 0;
+        return 0;
+    }
+  }
+  cap->block_in_use = 1;
+
+  frame = (struct tpacket3_hdr *) ((char *) block + block->hdr.bh1.offset_to_first_pkt);
+  for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+    unsigned char *ip = (unsigned char *) frame + frame->tp_net;
+    unsigned int iphdr = (ip[0] & 0x0f) * 4;
+    size_t udp_size = frame->tp_snaplen - (frame->tp_net - frame->tp_mac) - iphdr - 8;
+
+    // skip packets truncated by the capture, or too short
+    if (frame->tp_snaplen > (frame->tp_net - frame->tp_mac) + iphdr + 8 && udp_size >= cap->packet_size) {
+      cap->arrival[npackets] = frame->tp_sec * 1000000000UL + frame->tp_nsec;
+      cap->packets[npackets++] = (packet_t *) (ip + iphdr + 8);
+    } else {
+      cap->short_packets++;
+    }
+
+    frame = (struct tpacket3_hdr *) ((char *) frame + frame->tp_next_offset);
+  }
+
+  cap->npackets = npackets;
+  return npackets;
+}
+
+/**
+ * Hand the current block back to the kernel
+ *
+ * @param {capture_t *} cap The capture
+ */
+void capture_release_batch_tpacket(capture_t *cap) {
+  struct tpacket_block_desc *block = (struct tpacket_block_desc *) (cap->map + (size_t) cap->block * TPACKET_BLOCKSIZE);
+
+  if (!cap->block_in_use) {
+    return;
+  }
+
+  __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+  cap->block = (cap->block + 1) % TPACKET_NBLOCKS;
+  cap->block_in_use = 0;
+}
+
+/**
+ * Number of packets dropped by the kernel because the ring was full
+ * Reading the socket statistics resets them, so the drops are accumulated in the capture.
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {unsigned long} Number of dropped packets since the capture was opened
+ */
+unsigned long capture_drops_tpacket(capture_t *cap) {
+  struct tpacket_stats_v3 stats;
+  socklen_t len = sizeof(stats);
+
+  if (getsockopt(cap->sockfd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0) {
+    return atomic_fetch_add(&cap->drops, stats.tp_drops) + stats.tp_drops;
+  }
+  return atomic_load(&cap->drops);
+}
+
+/**
+ * Timestamps for the frames of the ring
+ * Every frame has a software receive timestamp; with hardware timestamps requested the raw hardware one replaces it.
+ *
+ * @param {capture_t *} cap The capture
+ * @param {int} flags SOF_TIMESTAMPING flags
+ * @returns {int} 0 on success, -1 on error
+ */
+int capture_timestamps_tpacket(capture_t *cap, int flags) {
+  if (flags & SOF_TIMESTAMPING_RAW_HARDWARE) {
+    flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+    return setsockopt(cap->sockfd, SOL_PACKET, PACKET_TIMESTAMP, &flags, sizeof(flags));
+  }
+  return 0;
+}
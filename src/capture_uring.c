@@ -0,0 +1,318 @@
+/**
+ * Packet capture backend for fill_ringbuffer using io_uring
+ *
+ * A single multishot recvmsg request keeps receiving packets into a ring of provided buffers,
+ * also while we are busy copying packets or rotating ringbuffer pages.
+ * All completions available are handed out as one batch; the buffers go back to the kernel when the batch is released.
+ */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "capture.h"
+
+#define URING_BUFSIZE (sizeof(struct io_uring_recvmsg_out) + CAPTURE_CONTROL + sizeof(packet_t))  // Size of a provided buffer
+#define URING_BGID    0                   // Buffer group id of the provided buffers
+
+/*
+ * io_uring state for a capture
+ */
+struct uring_state {
+  int fd;                             // io_uring file descriptor
+
+  unsigned *sq_head;                  // Submission queue
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_head;                  // Completion queue
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *buf_ring; // Ring of provided buffers
+  char *buffers;                      // Memory backing the provided buffers
+  unsigned short *bids;               // Buffer ids of the current batch
+
+  struct msghdr msg;                  // Template for the multishot recvmsg
+  int armed;                          // Is the multishot recvmsg active
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * Wait for at least one completion, or till the timeout expires
+ *
+ * @param {int} fd The io_uring
+ * @param {int} timeout Timeout in milliseconds
+ * @returns {int} 0 on success, -1 on error; errno is ETIME on timeout
+ */
+static int uring_wait(int fd, int timeout) {
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (timeout % 1000) * 1000000L;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (unsigned long) &ts;
+
+  return (int) syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0 ? -1 : 0;
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Queue and submit the multishot recvmsg request
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {int} 0 on success, -1 on error
+ */
+static int uring_arm(capture_t *cap) {
+  struct uring_state *u = cap->uring;
+  unsigned tail = *u->sq_tail;
+  unsigned index = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = cap->sockfd;
+  sqe->addr = (unsigned long) &u->msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+
+  u->sq_array[index] = index;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (uring_enter(u->fd, 1, 0, 0) < 0) {
+    return -1;
+  }
+  u->armed = 1;
+  return 0;
+}
+
+/**
+ * Open a UDP socket and an io_uring with a ring of provided buffers
+ *
+ * @param {capture_t *} cap The capture to open
+ * @param {int} port UDP port to receive on
+ * @param {int} index Index of this capture among the ones sharing the port
+ * @param {int} nsockets Number of captures sharing the port
+ */
+void capture_open_uring(capture_t *cap, int port, int index, int nsockets) {
+  struct uring_state *u;
+  struct io_uring_params params;
+  struct io_uring_buf_reg reg;
+  size_t sq_size, cq_size, ring_size;
+  char *sq_ring, *cq_ring;
+  int i;
+
+  cap->sockfd = init_network(port, nsockets > 1);
+  if (nsockets > 1 && index == 0) {
+    init_reuseport_filter(cap->sockfd, nsockets);
+  }
+
+  u = calloc(1, sizeof(struct uring_state));
+  cap->uring = u;
+
+  // the completion queue has room for a completion for every buffer
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = URING_NBUFS;
+  u->fd = uring_setup(8, &params);
+  if (u->fd < 0) {
+    perror("io_uring_setup");
+    exit(EXIT_FAILURE);
+  }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size = cq_size = (sq_size > cq_size ? sq_size : cq_size);
+  }
+
+  sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    perror("mmap io_uring");
+    exit(EXIT_FAILURE);
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring = sq_ring;
+  } else {
+    cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      perror("mmap io_uring");
+      exit(EXIT_FAILURE);
+    }
+  }
+  u->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    perror("mmap io_uring");
+    exit(EXIT_FAILURE);
+  }
+
+  u->sq_head = (unsigned *) (sq_ring + params.sq_off.head);
+  u->sq_tail = (unsigned *) (sq_ring + params.sq_off.tail);
+  u->sq_mask = (unsigned *) (sq_ring + params.sq_off.ring_mask);
+  u->sq_array = (unsigned *) (sq_ring + params.sq_off.array);
+  u->cq_head = (unsigned *) (cq_ring + params.cq_off.head);
+  u->cq_tail = (unsigned *) (cq_ring + params.cq_off.tail);
+  u->cq_mask = (unsigned *) (cq_ring + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes);
+
+  // provided buffers, and the ring to hand them to the kernel
+  ring_size = URING_NBUFS * sizeof(struct io_uring_buf);
+  u->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  u->buffers = alloc_hugepages(URING_NBUFS * URING_BUFSIZE);
+  u->bids = malloc(URING_NBUFS * sizeof(unsigned short));
+  cap->packets = malloc(URING_NBUFS * sizeof(packet_t *));
+  cap->arrival = calloc(URING_NBUFS, sizeof(unsigned long));
+  if (u->buf_ring == MAP_FAILED || !u->buffers || !u->bids || !cap->packets || !cap->arrival) {
+    LOG("ERROR: cannot allocate receive buffers\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long) u->buf_ring;
+  reg.ring_entries = URING_NBUFS;
+  reg.bgid = URING_BGID;
+  if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("IORING_REGISTER_PBUF_RING");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < URING_NBUFS; i++) {
+    u->buf_ring->bufs[i].addr = (unsigned long) (u->buffers + (size_t) i * URING_BUFSIZE);
+    u->buf_ring->bufs[i].len = URING_BUFSIZE;
+    u->buf_ring->bufs[i].bid = i;
+  }
+  __atomic_store_n(&u->buf_ring->tail, URING_NBUFS, __ATOMIC_RELEASE);
+
+  // we are not interested in the sender address; the control messages carry the drop counter
+  memset(&u->msg, 0, sizeof(struct msghdr));
+  u->msg.msg_controllen = CAPTURE_CONTROL;
+
+  if (uring_arm(cap) < 0) {
+    perror("io_uring_enter");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Collect all available completions as a batch, waiting for at least one, or for at most CAPTURE_TIMEOUT milliseconds
+ *
+ * @param {capture_t *} cap The capture
+ * @returns {int} Number of packets in the batch, which can be zero, or -1 on error
+ */
+int capture_next_batch_uring(capture_t *cap) {
+  struct uring_state *u = cap->uring;
+  unsigned head = *u->cq_head;
+  unsigned tail;
+  int npackets = 0;
+  int i, n = 0;
+
+  // re-arm the request when it stopped, for instance when we ran out of buffers
+  if (!u->armed && uring_arm(cap) < 0) {
+    return -1;
+  }
+
+  tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  while (head == tail) {
+    if (uring_wait(u->fd, CAPTURE_TIMEOUT) < 0) {
+      if (errno == ETIME) {
+        cap->npackets = 0;
+        return 0;
+      }
+      if (errno != EINTR) {
+        return -1;
+      }
+    }
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      u->armed = 0;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+      // all buffers are in use; the packets wait in the socket buffer till we re-arm
+      continue;
+    } else if (cqe->res < 0) {
+      errno = -cqe->res;
+      __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+      cap->npackets = npackets;
+      return -1;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) (u->buffers + (size_t) bid * URING_BUFSIZE);
+
+      u->bids[npackets] = bid;
+      // the name and control message parts have the sizes of the template, the payload follows them
+      cap->packets[npackets] = (packet_t *) ((char *) (out + 1) + u->msg.msg_namelen + u->msg.msg_controllen);
+      cap->arrival[npackets] = out->controllen ? capture_control(cap, (char *) (out + 1) + u->msg.msg_namelen, out->controllen) : 0;
+
+      // skip short packets, but keep the buffer for release; longer packets are truncated to a packet_t
+      if (out->payloadlen < cap->packet_size) {
+        cap->packets[npackets] = NULL;
+        cap->short_packets++;
+      }
+      npackets++;
+    }
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+  // compact the batch, skipped packets are returned with the rest
+  cap->nbids = npackets;
+  for (i = 0; i < npackets; i++) {
+    if (cap->packets[i]) {
+      cap->arrival[n] = cap->arrival[i];
+      cap->packets[n++] = cap->packets[i];
+    }
+  }
+
+  cap->npackets = n;
+  return n;
+}
+
+/**
+ * Return the buffers of the current batch to the kernel
+ *
+ * @param {capture_t *} cap The capture
+ */
+void capture_release_batch_uring(capture_t *cap) {
+  struct uring_state *u = cap->uring;
+  unsigned short tail = u->buf_ring->tail;
+  int i;
+
+  for (i = 0; i < cap->nbids; i++) {
+    struct io_uring_buf *buf = &u->buf_ring->bufs[(tail + i) & (URING_NBUFS - 1)];
+    buf->addr = (unsigned long) (u->buffers + (size_t) u->bids[i] * URING_BUFSIZE);
+    buf->len = URING_BUFSIZE;
+    buf->bid = u->bids[i];
+  }
+  __atomic_store_n(&u->buf_ring->tail, (unsigned short) (tail + cap->nbids), __ATOMIC_RELEASE);
+  cap->nbids = 0;
+}
@@ -0,0 +1,266 @@
+/**
+ * Check ringbuffer pages filled from a 'send' stream; used for development and debugging
+ *
+ * Every packet slot of a page is compared with the payload pattern that 'send' writes for it (see pattern.h).
+ * A slot is:
+ *  - ok:      it holds the payload of its own packet
+ *  - missing: its packet did not arrive; with an arrival mask (-M) the mask tells, otherwise the slot
+ *             holds the fill value
+ *  - wrong:   anything else, like a payload placed in the wrong slot, or a partly written payload
+ *
+ * The pages are read from files, one or more pages per file, for example the pages written by 'dada_dbdisk'
+ * (skip its header with -H). Page i is expected to hold the packets with timestamp <start> + i * 800000.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fill_ringbuffer.h"
+#include "transpose.h"
+#include "modes.h"
+#include "pattern.h"
+
+#define MAX_REPORTED 10           // Maximum number of wrong slots listed per page
+
+FILE *runlog = NULL;
+
+/*
+ * Layout of a page, see fill_ringbuffer
+ */
+typedef struct {
+  const science_mode_t *mode;
+  int padded_size;                // Bytes per channel for Stokes I
+  int transposed;                 // Stokes IQUV in [tab][stokes][channel][time] order
+  int mask_trailer;               // The arrival mask follows the data
+  int fill_value;                 // Value of the missing payloads
+  size_t data_size;               // Bytes of data in the page
+  size_t page_size;               // Bytes in the page, including the arrival mask
+  int nslots;                     // Number of packet slots
+} page_t;
+
+/**
+ * Print commandline optinos
+ */
+void printOptions() {
+  printf("usage: check_page -c <science case> -m <science mode> -s <timestamp of the first page> [-P <padded size>] [-T] [-M] [-F <value>] [-H <header size>] <page file> ...\n");
+  printf("e.g. check_page -c 3 -m 0 -s 1600000 -M page000.bin page001.bin\n");
+  printf("\n\nUse -T for transposed Stokes IQUV pages, -M for pages with the arrival mask after the data, and -F for the value of the missing payloads (default 0)\n");
+  printf("Skip a header of <header size> bytes at the start of every file with -H, for example 4096 for files written by dada_dbdisk\n");
+  return;
+}
+
+/**
+ * Parse commandline
+ */
+void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, unsigned long *start, int *padded_size, int *transposed, int *mask_trailer, int *fill_value, size_t *header_size) {
+  int setc=0, setm=0, sets=0;
+
+  int c;
+  while((c=getopt(argc,argv,"c:m:s:P:TMF:H:"))!=-1) {
+    switch(c) {
+      // -c case
+      case('c'):
+        *science_case = atoi(optarg);
+        setc=1;
+        break;
+
+      // -m mode
+      case('m'):
+        *science_mode = atoi(optarg);
+        setm=1;
+        break;
+
+      // -s timestamp of the first page
+      case('s'):
+        *start = atol(optarg);
+        sets=1;
+        break;
+
+      // -P padded size
+      case('P'):
+        *padded_size = atoi(optarg);
+        break;
+
+      // -T transposed Stokes IQUV
+      case('T'):
+        *transposed = 1;
+        break;
+
+      // -M arrival mask after the data
+      case('M'):
+        *mask_trailer = 1;
+        break;
+
+      // -F fill value
+      case('F'):
+        *fill_value = atoi(optarg);
+        break;
+
+      // -H header size
+      case('H'):
+        *header_size = atol(optarg);
+        break;
+
+      default:
+        printOptions();
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  // All arguments are required
+  if (!setc || !setm || !sets || optind == argc) {
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Copy the payload in a packet slot out of the page
+ *
+ * @param {page_t *} layout Layout of the page
+ * @param {const unsigned char *} page Start of the page
+ * @param {int} slot Packet slot
+ * @param {unsigned char *} payload Set to the payload
+ */
+void read_slot(page_t *layout, const unsigned char *page, int slot, unsigned char *payload) {
+  const science_mode_t *mode = layout->mode;
+  int sequence = slot % mode->sequence_length;
+  int row = slot / mode->sequence_length;
+  size_t channel_stride = mode->sequence_length * IQUV_SAMPLES;
+  size_t stokes_stride = NCHANNELS * channel_stride;
+  const unsigned char *src;
+  int t, k;
+
+  if ((mode->science_mode & 1) == 0) {
+    // Stokes I: [tab][channel][padded_size]
+    memcpy(payload, &page[row * layout->padded_size + sequence * mode->payload_size], mode->payload_size);
+  } else if (layout->transposed) {
+    // Stokes IQUV transposed: [tab][stokes][channel][sequence][IQUV_SAMPLES]
+    src = &page[(row / (NCHANNELS / 4)) * 4 * stokes_stride + (row % (NCHANNELS / 4)) * 4 * channel_stride + sequence * IQUV_SAMPLES];
+    for (k = 0; k < 16; k++) {
+      for (t = 0; t < IQUV_SAMPLES; t++) {
+        payload[t * 16 + k] = src[(k % 4) * stokes_stride + (k / 4) * channel_stride + t];
+      }
+    }
+  } else {
+    // Stokes IQUV: [tab][channel/4][sequence][payload]
+    memcpy(payload, &page[slot * mode->payload_size], mode->payload_size);
+  }
+}
+
+/**
+ * Check all packet slots of a page
+ *
+ * @param {page_t *} layout Layout of the page
+ * @param {const unsigned char *} page Start of the page
+ * @param {unsigned long} timestamp Timestamp of the packets in the page
+ * @returns {int} Number of wrong slots
+ */
+int check_page(page_t *layout, const unsigned char *page, unsigned long timestamp) {
+  const science_mode_t *mode = layout->mode;
+  const unsigned long *arrived = (const unsigned long *) &page[layout->data_size];
+  unsigned char payload[PAYLOADSIZE_MAX];
+  unsigned char expected[PAYLOADSIZE_MAX];
+  unsigned char filled[PAYLOADSIZE_MAX];
+  int rows_per_tab = mode->rows_per_tab;
+  int ok = 0, missing = 0, wrong = 0;
+  int slot, tab, channel, sequence;
+
+  memset(filled, layout->fill_value, mode->payload_size);
+  for (slot = 0; slot < layout->nslots; slot++) {
+    tab = slot / mode->sequence_length / rows_per_tab;
+    channel = slot / mode->sequence_length % rows_per_tab * mode->channels_per_packet;
+    sequence = slot % mode->sequence_length;
+
+    read_slot(layout, page, slot, payload);
+    pattern_fill(expected, mode->payload_size, pattern_key(tab, channel, sequence, timestamp));
+
+    if (memcmp(payload, expected, mode->payload_size) == 0 &&
+        (!layout->mask_trailer || (arrived[slot / 64] >> (slot % 64) & 1))) {
+      ok++;
+    } else if (layout->mask_trailer ? !(arrived[slot / 64] >> (slot % 64) & 1) : memcmp(payload, filled, mode->payload_size) == 0) {
+      missing++;
+    } else {
+      if (wrong < MAX_REPORTED) {
+        printf("  wrong slot %i: tab %i channel %i sequence %i\n", slot, tab, channel, sequence);
+      }
+      wrong++;
+    }
+  }
+
+  printf("Time %lu: %i slots, ok %i, missing %i (%.3f%%), wrong %i\n",
+      timestamp, layout->nslots, ok, missing, 100.0 * missing / layout->nslots, wrong);
+  return wrong;
+}
+
+int main(int argc, char *argv[]) {
+  int science_case;
+  int science_mode;
+  unsigned long start;
+  int padded_size = STOKESI_ROW_SIZE;
+  int transposed = 0;
+  int mask_trailer = 0;
+  int fill_value = 0;
+  size_t header_size = 0;
+
+  page_t layout;
+  const unsigned char *map;
+  size_t offset;
+  struct stat st;
+  unsigned long page = 0;
+  long wrong = 0;
+  int fd;
+  int f;
+
+  parseOptions(argc, argv, &science_case, &science_mode, &start, &padded_size, &transposed, &mask_trailer, &fill_value, &header_size);
+
+  layout.mode = science_mode_lookup(science_case, science_mode);
+  if (!layout.mode) {
+    fprintf(stderr, "Illegal science case %i or mode %i\n", science_case, science_mode);
+    exit(EXIT_FAILURE);
+  }
+  layout.padded_size = padded_size;
+  layout.transposed = transposed;
+  layout.mask_trailer = mask_trailer;
+  layout.fill_value = fill_value;
+  layout.nslots = layout.mode->nslots;
+  layout.data_size = science_mode_page_size(layout.mode, padded_size);
+  layout.page_size = layout.data_size + (mask_trailer ? (layout.nslots + 63) / 64 * sizeof(unsigned long) : 0);
+
+  for (f = optind; f < argc; f++) {
+    fd = open(argv[f], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+      perror(argv[f]);
+      exit(EXIT_FAILURE);
+    }
+    if (st.st_size < header_size + layout.page_size) {
+      // like the empty page at the end of the data
+      fprintf(stderr, "Skipping %s: smaller than a page of %lu bytes\n", argv[f], layout.page_size);
+      close(fd);
+      continue;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      perror(argv[f]);
+      exit(EXIT_FAILURE);
+    }
+    madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+    printf("%s\n", argv[f]);
+    for (offset = header_size; offset + layout.page_size <= st.st_size; offset += layout.page_size) {
+      wrong += check_page(&layout, &map[offset], start + page * FRAME_TIMESTAMPS);
+      page++;
+    }
+    munmap((void *) map, st.st_size);
+  }
+
+  printf("Checked %lu pages, %li wrong slots\n", page, wrong);
+  return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -23,15 +23,12 @@
 #include "dada_hdu.h"
 #include "futils.h"
 #include "config.h"
-
-#define NCHANNELS 1536
+#include "modes.h"
 
 #define UMSBATCH (1000000.0)       // sleep time in microseconds between sending batches
 
 FILE *runlog = NULL;
 
-char *science_modes[] = {"I+TAB", "IQUV+TAB", "I+IAB", "IQUV+IAB"};
-
 // #define LOG(...) {fprintf(logio, __VA_ARGS__)}; 
 #define LOG(...) {fprintf(stdout, __VA_ARGS__); fprintf(runlog, __VA_ARGS__); fflush(stdout);}
 
@@ -203,9 +200,8 @@ int main(int argc, char** argv) {
   int duration;            // run time in seconds
   int science_case;        // 3 or 4
   int science_mode;        // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
-  int ntabs;
-  int ntimes;
   int padded_size;
+  const science_mode_t *mode_desc;
 
   // local vars
   char *header;
@@ -236,35 +232,17 @@ int main(int argc, char** argv) {
   free(header); header = NULL;
   free(key); key = NULL;
 
+  mode_desc = science_mode_lookup(science_case, science_mode);
+  if (!mode_desc) {
+    LOG("Science case %i, mode %i not supported\n", science_case, science_mode);
+    goto exit;
+  }
   LOG("Science case = %i\n", science_case);
-  LOG("Science mode = %i [ %s ]\n", science_mode, science_modes[science_mode]);
+  LOG("Science mode = %i [ %s ]\n", science_mode, mode_desc->name);
   LOG("Duration (batches) = %i\n", duration);
 
-  if (science_case == 3) {
-    ntimes = 12500;
-    switch (science_mode) {
-      case 0: ntabs = 12; break;
-      case 1: ntabs = 12; break;
-      case 2: ntabs = 1; break;
-      case 3: ntabs = 1; break;
-      default:
-        LOG("Science mode not supported");
-        break;
-    }
-  } else if (science_case == 4) {
-    ntimes = 12500;
-    switch (science_mode) {
-      case 0: ntabs = 12; break;
-      case 1: ntabs = 12; break;
-      case 2: ntabs = 1; break;
-      case 3: ntabs = 1; break;
-      default:
-        LOG("Science mode not supported");
-        break;
-    }
-  } else {
-    ntabs = 1;
-    LOG("Science case not supported");
+  if (required_size < science_mode_page_size(mode_desc, padded_size)) {
+    LOG("ERROR. ring buffer data block too small, should be at least %lu\n", science_mode_page_size(mode_desc, padded_size));
     goto exit;
   }
 
@@ -0,0 +1,135 @@
+/**
+ * Overwrite the payloads of missing packets in a ringbuffer page
+ *
+ * The page is written with non-temporal stores, bypassing the cache,
+ * so the fill does not evict the cache lines used by the receivers.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "fill_ringbuffer.h"
+#include "fill_missing.h"
+#include "transpose.h"
+
+/**
+ * Set a block of memory to a value using non-temporal stores
+ * The caller should issue a store fence before the memory is handed to another thread or process
+ *
+ * @param {char *} dest Start of the block
+ * @param {size_t} len Length of the block in bytes
+ * @param {unsigned char} value Value to write
+ */
+void fill_bytes_nt(char *dest, size_t len, unsigned char value) {
+  __m128i v = _mm_set1_epi8(value);
+  size_t head;
+
+  // unaligned head with normal stores
+  head = (16 - ((uintptr_t)dest & 15)) & 15;
+  if (head >= len) {
+    memset(dest, value, len);
+    return;
+  }
+  memset(dest, value, head);
+  dest += head;
+  len -= head;
+
+  // aligned body, a cache line at a time
+  while (len >= 64) {
+    _mm_stream_si128((__m128i *)(dest +  0), v);
+    _mm_stream_si128((__m128i *)(dest + 16), v);
+    _mm_stream_si128((__m128i *)(dest + 32), v);
+    _mm_stream_si128((__m128i *)(dest + 48), v);
+    dest += 64;
+    len -= 64;
+  }
+  while (len >= 16) {
+    _mm_stream_si128((__m128i *)dest, v);
+    dest += 16;
+    len -= 16;
+  }
+
+  // tail
+  memset(dest, value, len);
+}
+
+/**
+ * Fill the 16 time series of a missing Stokes IQUV packet slot in a transposed page
+ *
+ * @param {char *} page Start of the ringbuffer page
+ * @param {page_layout_t *} layout Layout of the packet slots in the page
+ * @param {int} slot The packet slot
+ * @param {unsigned char} value Value to write
+ */
+static void fill_transposed(char *page, const page_layout_t *layout, int slot, unsigned char value) {
+  size_t channel_stride = layout->sequence_length * IQUV_SAMPLES;
+  size_t stokes_stride = NCHANNELS * channel_stride;
+  int row = slot / layout->sequence_length;
+  char *dest;
+  int k;
+
+  dest = page + (row / (NCHANNELS / 4)) * 4 * stokes_stride + (row % (NCHANNELS / 4)) * 4 * channel_stride
+    + (slot % layout->sequence_length) * IQUV_SAMPLES;
+  for (k = 0; k < 16; k++) {
+    fill_bytes_nt(dest + (k % 4) * stokes_stride + (k / 4) * channel_stride, IQUV_SAMPLES, value);
+  }
+}
+
+/**
+ * Fill the payloads of all packet slots that did not arrive
+ * Consecutive missing slots in the same row are filled as one block.
+ *
+ * @param {char *} page Start of the ringbuffer page
+ * @param {unsigned long *} arrived Packet arrival mask, one bit per slot
+ * @param {page_layout_t *} layout Layout of the packet slots in the page
+ * @param {unsigned char} value Value to write
+ * @returns {long} Number of slots filled
+ */
+long fill_missing(char *page, const unsigned long *arrived, const page_layout_t *layout, unsigned char value) {
+  int nwords = (layout->nslots + 63) / 64;
+  char *start = NULL;       // Start of the current block to fill
+  char *end = NULL;         // End of the current block to fill
+  char *dest;
+  long nfilled = 0;
+  unsigned long missing;
+  int slot;
+  int w;
+
+  for (w = 0; w < nwords; w++) {
+    missing = ~arrived[w];
+    if (w == nwords - 1 && layout->nslots % 64) {
+      missing &= (1UL << (layout->nslots % 64)) - 1;
+    }
+
+    while (missing) {
+      slot = w * 64 + __builtin_ctzl(missing);
+      missing &= missing - 1;
+      nfilled++;
+
+      if (layout->transposed) {
+        fill_transposed(page, layout, slot, value);
+        continue;
+      }
+
+      dest = page + (slot / layout->sequence_length) * layout->row_size + (slot % layout->sequence_length) * layout->payload_size;
+      if (dest == end) {
+        // extend the current block
+        end += layout->payload_size;
+        continue;
+      }
+      if (start) {
+        fill_bytes_nt(start, end - start, value);
+      }
+      start = dest;
+      end = dest + layout->payload_size;
+    }
+  }
+  if (start) {
+    fill_bytes_nt(start, end - start, value);
+  }
+
+  // make the non-temporal stores visible before the page is handed over
+  _mm_sfence();
+
+  return nfilled;
+}
@@ -0,0 +1,26 @@
+/**
+ * Overwrite the payloads of missing packets in a ringbuffer page
+ *
+ * The packet slots of a page are laid out as rows of 'sequence_length' consecutive payloads,
+ * with 'row_size' bytes between the rows:
+ *  - Stokes I:    rows are the (tab, channel) pairs, row_size is the padded size
+ *  - Stokes IQUV: rows are the (tab, channel / 4) pairs, row_size is sequence_length * payload_size
+ *  - Stokes IQUV transposed: a packet slot is spread over 16 time series, see transpose.h
+ */
+#ifndef FILL_MISSING_H
+#define FILL_MISSING_H
+
+#include <stddef.h>
+
+typedef struct {
+  int nslots;                 // Number of packet slots in the page
+  int sequence_length;        // Number of packet slots per row
+  size_t row_size;            // Bytes between the start of two rows
+  size_t payload_size;        // Bytes per packet slot
+  int transposed;             // Stokes IQUV in [tab][stokes][channel][time] order
+} page_layout_t;
+
+void fill_bytes_nt(char *dest, size_t len, unsigned char value);
+long fill_missing(char *page, const unsigned long *arrived, const page_layout_t *layout, unsigned char value);
+
+#endif
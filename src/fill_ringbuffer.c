@@ -15,50 +15,43 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <stddef.h>
 #include <byteswap.h>
 #include <math.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "dada_hdu.h"
 #include "ascii_header.h"
 #include "futils.h"
 #include "config.h"
-
-#define PACKHEADER 114                   // Size of the packet header = PACKETSIZE-PAYLOADSIZE in bytes
-
-#define PACKETSIZE_STOKESI  6364         // Size of the packet, including the header in bytes
-#define PAYLOADSIZE_STOKESI 6250         // Size of the record = packet - header in bytes
-
-#define PACKETSIZE_STOKESIQUV  8114      // Size of the packet, including the header in bytes
-#define PAYLOADSIZE_STOKESIQUV 8000      // Size of the record = packet - header in bytes
-#define PAYLOADSIZE_MAX        8000      // Maximum of payload size of I, IQUV
-
-#define TIMEUNIT 781250           // Conversion factor of timestamp from seconds to (1.28 us) packets
-
-#define MMSG_VLEN  256            // Batch message into single syscal using recvmmsg()
-
-/* We currently use
- *  - one compound beam per instance
- *  - one instance of fill_ringbuffer connected to
- *  - one HDU
- *
- * Send on to ringbuffer a single second of data as a three dimensional array:
- * [tab_index][channel][record] of sizes [0..11][0..1535][0..paddedsize-1] = 18432 * paddedsize for a ringbuffer page
- *
- * SC3: records per 1.024s 12500; 9 TABs
- * SC4: records per 1.024s 12500; 12 TABs
- */
-
-#define NCHANNELS 1536
-#define PACKETRATESC3 12500 // SC3: records per 1.024s
-#define PACKETRATESC4 12500 // SC4: records per 1.024s
-
-#define SOCKBUFSIZE 67108864      // Buffer size of socket
+#include "fill_ringbuffer.h"
+#include "capture.h"
+#include "fill_missing.h"
+#include "stream_copy.h"
+#include "transpose.h"
+#include "affinity.h"
+#include "validate.h"
+#include "stats.h"
+#include "histogram.h"
+#include "modes.h"
+
+#define NO_OBSERVATION ULONG_MAX   // Start packet while waiting for the next observation in daemon mode
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23    // Linux 5.14, not yet in older C libraries
+#endif
 
 FILE *runlog = NULL;
 
-char *science_modes[] = {"I+TAB", "IQUV+TAB", "I+IAB", "IQUV+IAB"};
-
 // Due to issues with the FPGAs upstream from us, the packet headers are wrong.
 // Work around it for now by using this table with correct frequencies. (search for FREQISSUE below)
 extern const unsigned short remap_frequency_sc4[1536];
@@ -66,50 +59,171 @@ extern const unsigned short remap_frequency_sc4[1536];
 // global state needed for SIGTERM shutdown
 dada_hdu_t *signal_hdu = NULL;
 size_t signal_required_size = 0;
-int signal_sockfd = -1;
+int signal_sockfd[MAX_THREADS];
+int signal_nsockfd = 0;
+FILE *signal_quarantine = NULL;
+atomic_int *signal_rotating = NULL;          // The rotation lock, 'rotating' of the ring state
+atomic_flag signal_exiting = ATOMIC_FLAG_INIT; // Set by the first thread calling clean_exit
+
+// per thread state needed for the shutdown
+static __thread void *thread_receiver = NULL; // The receiver_t of a receiver thread, NULL for the other threads
+static __thread int thread_rotating = 0;      // Does this thread hold the rotation lock
+
+// How packets are placed in the page; every layout has its own placement routine, see place_packet
+#define PLACEMENT_STOKESI              0   // [tab][channel][padded_size]
+#define PLACEMENT_STOKESI_REMAPPED     1   // Stokes I, with the channels remapped by the FREQISSUE workaround
+#define PLACEMENT_STOKESIQUV           2   // [tab][channel/4][sequence][payload]
+#define PLACEMENT_STOKESIQUV_TRANSPOSED 3  // [tab][stokes][channel][sequence][IQUV_SAMPLES]
+
+// What to do with packets with a bad header
+#define POLICY_DROP       0   // drop and count
+#define POLICY_QUARANTINE 1   // drop and count, and write them to a file
+#define POLICY_ABORT      2   // drop and count, and stop the run when there are too many per second
+
 
 /*
- * Header description based on:
- * ARTS Interface Specification from BF to SC3+4
- * ASTRON_SP_066_InterfaceSpecificationSC34.pdf
- * revision 2.0
+ * An open ringbuffer page
  */
 typedef struct {
-  unsigned char marker_byte;         // See table 3 in PDF, page 6
-  unsigned char format_version;      // Version: 1
-  unsigned char cb_index;            // [0,39] one compound beam per fill_ringbuffer instance:: ignore
-  unsigned char tab_index;           // [0,ntabs-1] all tabs per fill_ringbuffer instance
-  unsigned short channel_index;      // [0,1535] all channels per fill_ringbuffer instance
-  unsigned short payload_size;       // Stokes I: 6250, IQUV: 8000
-  unsigned long timestamp;           // units of 1.28 us, since 1970-01-01 00:00.000 
-  unsigned char sequence_number;     // SC3: Stokes I: 0-1, Stokes IQUV: 0-24
-                                     // SC4: Stokes I: 0-1, Stokes IQUV: 0-24
-  unsigned char reserved[7];
-  unsigned long flags[3];
-  unsigned char record[PAYLOADSIZE_MAX];
-} packet_t;
-
-// #define LOG(...) {fprintf(logio, __VA_ARGS__)}; 
-#define LOG(...) {fprintf(stdout, __VA_ARGS__); fprintf(runlog, __VA_ARGS__); fflush(stdout);}
+  char *buf;                           // Page memory
+  unsigned long timestamp;             // Timestamp of the packets in this page
+  long opened;                         // Time the page was opened, in ms (CLOCK_MONOTONIC)
+} page_t;
+
+/*
+ * Run parameters and ringbuffer page state, shared by all receiver threads
+ *
+ * Up to 'window' consecutive dada pages are open at the same time, to give late packets a chance.
+ * The open pages only change during a rotation, which is done by a single thread at a time,
+ * elected by a compare-and-swap on 'rotating'.
+ * Receiver threads announce they are writing to the open pages in their 'hold' field; the rotating thread
+ * waits until no thread holds the pages before changing them.
+ */
+typedef struct {
+  dada_hdu_t *hdu;
+  size_t required_size;
+  int science_mode;
+  int ntabs;
+  int sequence_length;
+  int padded_size;
+  int packets_per_sample;
+  int placement;                       // PLACEMENT_*, the layout of the packets in the page
+  int zerocopy;                        // Receive payloads directly into the page
+  int transpose;                       // Write Stokes IQUV as [tab][stokes][channel][time]
+  int window;                          // Maximum number of open pages
+  int nslots;                          // Number of packets per page, ie. bits in the arrival mask
+  int mask_trailer;                    // Write the arrival mask after the data in the page
+  int fill;                            // Overwrite the payloads of missing packets before releasing a page
+  unsigned char fill_value;            // Value to overwrite missing payloads with
+  page_layout_t layout;                // Layout of the packet slots in a page
+  int timeout;                         // Release the oldest page when the next has been open this long (ms), 0 for never
+  unsigned char expected_marker_byte;
+  unsigned short expected_payload;
+  _Atomic unsigned long startpacket;   // Start of the observation, NO_OBSERVATION when there is none
+  unsigned long endpacket;
+  atomic_int running;                  // Set while an observation is running
+  int daemon_mode;                     // Wait for the next observation instead of exiting at the end
+  int idle_sample;                     // While idling, keep one in this many packets
+  int policy;                          // What to do with bad packets: POLICY_DROP, POLICY_QUARANTINE or POLICY_ABORT
+  int abort_limit;                     // POLICY_ABORT: stop when more bad packets arrive in one second
+  FILE *quarantine;                    // POLICY_QUARANTINE: file for the bad packets
+  _Atomic long bad_second;             // POLICY_ABORT: the current second (CLOCK_MONOTONIC)
+  atomic_ulong bad_in_second;          // POLICY_ABORT: number of bad packets in the current second
+
+  page_t pages[MAX_WINDOW];            // Open pages, a circular buffer starting at 'first'
+  atomic_ulong *arrived[MAX_WINDOW];   // Packet arrival mask per open page, one bit per packet slot
+  int first;                           // Slot of the oldest open page
+  int npages;                          // Number of open pages
+  char *initial_buf;                   // Page requested before the start, used for the first timestamp
+  _Atomic long deadline;               // Time (ms) to release the oldest page on timeout, 0 for none
+  _Atomic long end_deadline;           // Time (ms) to end the observation when no packets past its end arrive, 0 for none
+
+  _Atomic unsigned long generation;    // Incremented on every change of the open pages
+  atomic_int rotating;                 // Set while a thread is rotating pages
+
+  stats_t *stats;                      // Run statistics in shared memory, NULL when not published
+  stats_t totals;                      // Statistics of the released pages and rotations, published by stats_run
+  pthread_mutex_t stats_lock;          // Protects 'totals'
+
+  int timestamps;                      // Receive timestamps: TIMESTAMPS_OFF, TIMESTAMPS_SOFTWARE or TIMESTAMPS_HARDWARE
+  histogram_t spread;                  // Time between the first and the last packet of the released pages, in ns
+} ringstate_t;
+
+/*
+ * Receive times of the packets of an open page, per receiver
+ */
+typedef struct {
+  histogram_t latency;                 // Receive time minus the packet timestamp, in ns
+  unsigned long early;                 // Number of packets received before their timestamp, ie. the clocks differ
+  unsigned long first;                 // First receive time, in ns since the epoch, 0 for none
+  unsigned long last;                  // Last receive time
+} arrivals_t;
+
+/*
+ * Per thread receiver state
+ */
+typedef struct {
+  int id;
+  int core;                          // Core to pin the thread to, or -1
+  pthread_t thread;
+  ringstate_t *ring;
+
+  _Atomic unsigned long hold;        // Generation of the open pages this thread is writing to, 0 when not writing
+  atomic_int idle;                   // Set while waiting for the start of an observation
+  atomic_ulong late;                 // Number of packets for pages that were already released
+  atomic_ulong duplicates;           // Number of packets that were already received
+  atomic_ulong bad[NBAD];            // Number of packets with a bad header, per reason
+  atomic_ulong packets;              // Number of packets received while not idle
+  atomic_ulong batches;              // Number of batches received while not idle
+  unsigned long drops_released;      // Kernel drops of the capture at the last released page, used by the rotating thread
+  arrivals_t arrivals[MAX_WINDOW];   // Receive times per open page, written while holding the pages
+
+  capture_t capture;                 // Packet source
+  int packet_idx;                    // Index of the next packet in the current batch
+  unsigned char cb_index;            // Compound beam index (fixed per run)
+  header_check_t check;              // Expected header values, for batch validation
+} receiver_t;
+
+// Copy a packet with a valid header to the ringbuffer
+typedef void (*place_t)(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival);
+
+int nreceivers = 0;
+receiver_t receivers[MAX_THREADS];
 
 /**
  * Print commandline optinos
  */
 void printOptions() {
-  printf("usage: fill_ringbuffer -h <header file> -k <hexadecimal key> -c <science case> -m <science mode> -s <start packet number> -d <duration (s)> -p <port> -l <logfile>\n");
+  printf("usage: fill_ringbuffer -h <header file> -k <hexadecimal key> -c <science case> -m <science mode> -s <start packet number> -d <duration (s)> -p <port> -l <logfile> [-t <threads>] [-z] [-b <backend>] [-i <interface>] [-w <pages>] [-W <timeout (ms)>] [-M] [-F <value>] [-C <copy kernel>] [-T] [-a <cores>] [-A <core>] [-N] [-V <policy>] [-D <control fifo>] [-I <n>] [-S <name>] [-L <timestamps>] [-r <pcap file>]\n");
   printf("e.g. fill_ringbuffer -h \"header1.txt\" -k 10 -s 11565158400000 -c 3 -m 0 -d 3600 -p 4000 -l log.txt\n");
   printf("\n\nA workaround for the incorrect frequencies in the packets headers for science case 4, stokesI, can be enabled with '-f'\n");
+  printf("Receive with multiple threads, each pinned to a core and with its own SO_REUSEPORT socket, using '-t <threads>' (default 1, max %i)\n", MAX_THREADS);
+  printf("Receive payloads directly into the ringbuffer, without an intermediate copy, with '-z'\n");
+  printf("Select the capture backend with '-b recvmmsg' (default), '-b tpacket', or '-b uring'; tpacket needs the network interface: '-i <interface>'\n");
+  printf("Pin the receivers to a list of cores with '-a <cores>', for example '-a 2-5,8', and the other threads with '-A <core>'\n");
+  printf("With '-i <interface>' the receivers run on the NUMA node of the network interface, and '-N' binds the ringbuffer memory to that node\n");
+  printf("Keep up to '-w <pages>' ringbuffer pages open for late packets (default 1, max %i); with more than one page, release the oldest page when the next page has been open for '-W <timeout (ms)>' (default 100, 0 to disable)\n", MAX_WINDOW);
+  printf("Write the packet arrival mask in a trailer after the data in each page with '-M'\n");
+  printf("Overwrite the data of missing packets with a value (0 to 255) before releasing a page with '-F <value>'\n");
+  printf("Write Stokes IQUV (science modes 1 and 3) transposed to [tab][stokes][channel][time] with '-T'\n");
+  printf("Select the payload copy kernel with '-C auto' (default), '-C avx512', '-C avx2', '-C sse2', or '-C memcpy'\n");
+  printf("Run as a daemon with '-D <control fifo>', reading observations as lines '<header file> <start packet> <duration (s)>' from the fifo; -h, -s, and -d then give the first observation, and are optional\n");
+  printf("While idling before the start, keep only one in '-I <n>' packets (default %i, 1 keeps all); all packets are captured from %.1f s before the start\n", IDLE_SAMPLE, 1.0 * IDLE_MARGIN / TIMEUNIT);
+  printf("Publish the run statistics in POSIX shared memory every %i ms with '-S <name>', for example '-S /fill_ringbuffer', and read them with fill_stats\n", STATS_INTERVAL);
+  printf("Log the arrival latency of the packets per page with '-L software' or '-L hardware' receive timestamps; hardware timestamps need the clock of the network interface '-i' to be synchronized, for example with PTP\n");
+  printf("Read the packets from a pcap file instead of the network port, as fast as possible, with '-r <pcap file>'; -p is then optional, and '-L' logs the arrival times recorded in the file\n");
+  printf("Packets with a bad header are dropped and counted with '-V drop' (default), also written to a file with '-V quarantine:<file>', or stop the run when more than N arrive in a second with '-V abort:<N>'\n");
   return;
 }
 
 /**
  * Parse commandline
  */
-void parseOptions(int argc, char*argv[], char **header, char **key, unsigned long *startpacket, float *duration, int *port, char **logfile, int *freqissue_workaround) {
+void parseOptions(int argc, char*argv[], char **header, char **key, unsigned long *startpacket, float *duration, int *port, char **logfile, int *freqissue_workaround, int *nthreads, int *zerocopy, int *backend, char **interface, int *window, int *timeout, int *mask_trailer, int *fill_value, int *copy_kernel, int *transpose, int *cores, int *ncores, int *helper_core, int *bind_numa, int *policy, int *abort_limit, char **quarantine, char **control, int *idle_sample, char **stats, int *timestamps, char **input) {
   int c;
 
   int seth=0, setk=0, sets=0, setd=0, setp=0, setl=0;
-  while((c=getopt(argc,argv,"h:k:s:d:p:l:f"))!=-1) {
+  while((c=getopt(argc,argv,"h:k:s:d:p:l:ft:zb:i:w:W:MF:C:Ta:A:NV:D:I:S:L:r:"))!=-1) {
     switch(c) {
       // -f work around for the FREQISSUE
       case('f'):
@@ -152,12 +266,179 @@ void parseOptions(int argc, char*argv[], char **header, char **key, unsigned lon
         setl=1;
         break;
 
+      // -t number of receiver threads
+      case('t'):
+        *nthreads = atoi(optarg);
+        if (*nthreads < 1 || *nthreads > MAX_THREADS) {
+          fprintf(stderr, "Number of threads should be between 1 and %i\n", MAX_THREADS);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -z zero-copy receive
+      case('z'):
+        *zerocopy = 1;
+        break;
+
+      // -b capture backend
+      case('b'):
+        *backend = capture_backend(optarg);
+        if (*backend < 0) {
+          fprintf(stderr, "Unknown capture backend '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -i network interface
+      case('i'):
+        *interface = strdup(optarg);
+        break;
+
+      // -w number of open ringbuffer pages
+      case('w'):
+        *window = atoi(optarg);
+        if (*window < 1 || *window > MAX_WINDOW) {
+          fprintf(stderr, "Number of open pages should be between 1 and %i\n", MAX_WINDOW);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -W page timeout in milliseconds
+      case('W'):
+        *timeout = atoi(optarg);
+        if (*timeout < 0) {
+          fprintf(stderr, "Page timeout should not be negative\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -M write the arrival mask after the data
+      case('M'):
+        *mask_trailer = 1;
+        break;
+
+      // -F fill value for missing packets
+      case('F'):
+        *fill_value = atoi(optarg);
+        if (*fill_value < 0 || *fill_value > 255) {
+          fprintf(stderr, "Fill value should be between 0 and 255\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -C payload copy kernel
+      case('C'):
+        *copy_kernel = stream_copy_kernel(optarg);
+        if (*copy_kernel < STREAM_COPY_AUTO) {
+          fprintf(stderr, "Unknown copy kernel '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -T transpose Stokes IQUV
+      case('T'):
+        *transpose = 1;
+        break;
+
+      // -a receiver cores
+      case('a'):
+        *ncores = parse_cpulist(optarg, cores, CPU_SETSIZE);
+        if (*ncores <= 0) {
+          fprintf(stderr, "Invalid list of cores '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -A helper thread core
+      case('A'):
+        *helper_core = atoi(optarg);
+        break;
+
+      // -N bind the ringbuffer to the NUMA node of the network interface
+      case('N'):
+        *bind_numa = 1;
+        break;
+
+      // -V policy for packets with a bad header
+      case('V'):
+        if (strcmp(optarg, "drop") == 0) {
+          *policy = POLICY_DROP;
+        } else if (strncmp(optarg, "quarantine:", 11) == 0 && optarg[11]) {
+          *policy = POLICY_QUARANTINE;
+          *quarantine = strdup(&optarg[11]);
+        } else if (strcmp(optarg, "abort") == 0) {
+          *policy = POLICY_ABORT;
+          *abort_limit = 0;
+        } else if (strncmp(optarg, "abort:", 6) == 0 && atoi(&optarg[6]) >= 0) {
+          *policy = POLICY_ABORT;
+          *abort_limit = atoi(&optarg[6]);
+        } else {
+          fprintf(stderr, "Unknown policy for bad packets '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -D run as a daemon, reading observations from a control fifo
+      case('D'):
+        *control = strdup(optarg);
+        break;
+
+      // -I packet sampling while idling
+      case('I'):
+        *idle_sample = atoi(optarg);
+        if (*idle_sample < 1) {
+          fprintf(stderr, "Idle sampling should be at least 1\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -S publish the run statistics in shared memory
+      case('S'):
+        *stats = strdup(optarg);
+        break;
+
+      // -L receive timestamps for the arrival latency
+      case('L'):
+        if (strcmp(optarg, "software") == 0) {
+          *timestamps = TIMESTAMPS_SOFTWARE;
+        } else if (strcmp(optarg, "hardware") == 0) {
+          *timestamps = TIMESTAMPS_HARDWARE;
+        } else {
+          fprintf(stderr, "Unknown receive timestamps '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -r read the packets from a pcap file
+      case('r'):
+        *input = strdup(optarg);
+        break;
+
       default:
         printOptions();
         exit(EXIT_SUCCESS);
     }
   }
 
+  // A file replaces the network port
+  if (*backend == CAPTURE_FILE && !*input) {
+    fprintf(stderr, "The file backend needs a pcap file: '-r <pcap file>'\n");
+    exit(EXIT_FAILURE);
+  }
+  if (*input) {
+    *backend = CAPTURE_FILE;
+    setp = 1;
+    if (*control) {
+      fprintf(stderr, "Cannot run as a daemon when reading from a file\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // In daemon mode the first observation can also come from the control fifo
+  if (*control && !seth && !sets && !setd) {
+    seth = sets = setd = 1;
+  }
+
   // All arguments are required
   if (!seth || !setk || !sets || !setd || !setp || !setl) {
     if (!seth) fprintf(stderr, "DADA header not set\n");
@@ -168,59 +449,57 @@ void parseOptions(int argc, char*argv[], char **header, char **key, unsigned lon
     if (!setl) fprintf(stderr, "Log file not set\n");
     exit(EXIT_FAILURE);
   }
+
+  // Zero-copy receiving reads from the UDP socket
+  if (*zerocopy && *backend != CAPTURE_RECVMMSG) {
+    fprintf(stderr, "Zero-copy receiving needs the recvmmsg backend\n");
+    exit(EXIT_FAILURE);
+  }
+  if (*zerocopy && *transpose) {
+    fprintf(stderr, "Zero-copy receiving cannot transpose the payloads\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((*backend == CAPTURE_TPACKET || *bind_numa || (*timestamps == TIMESTAMPS_HARDWARE && !*input)) && !*interface) {
+    fprintf(stderr, "Network interface not set\n");
+    exit(EXIT_FAILURE);
+  }
 }
 
 /**
- * Open a socket to read from a network port
+ * Read a header file into a buffer, and get the run parameters from it
  *
- * @param {int} port Network port to connect to
- * @returns {int} socket file descriptor
+ * @param {char *} header String containing the header file name to read
+ * @param {char *} buf Buffer for the header
+ * @param {uint64_t} bufsz Size of the buffer
+ * @param {int *} science_case read from the header file, and stored here
+ * @param {int *} science_mode read from the header file, and stored here
+ * @param {int *} padded_size read from the header file, and stored here
+ * @returns {int} 0 on success, -1 when the header cannot be read or is incomplete
  */
-int init_network(int port) {
-  int sock;
-  struct addrinfo hints, *servinfo, *p;
-  char service[256];
-
-  memset(&hints, 0, sizeof hints);
-  hints.ai_family = AF_INET; // set to AF_INET to force IPv4
-  hints.ai_socktype = SOCK_DGRAM;
-  hints.ai_flags = AI_PASSIVE; // use my IP
+int read_header(char *header, char *buf, uint64_t bufsz, int *science_case, int *science_mode, int *padded_size) {
+  int header_incomplete = 0;
 
-  snprintf(service, 255, "%i", port);
-  if (getaddrinfo(NULL, service, &hints, &servinfo) != 0) {
-    perror(NULL);
-    exit(EXIT_FAILURE);
+  // read header from file
+  if (fileread (header, buf, bufsz) < 0) { 
+    LOG("ERROR. Cannot read header from %s\n", header);
+    return -1;
   }
 
-  for(p = servinfo; p != NULL; p = p->ai_next) {
-    sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (sock == -1) {
-      perror(NULL);
-      continue;
-    }
-
-    // set socket buffer size
-    int sockbufsize = SOCKBUFSIZE;
-    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sockbufsize, (socklen_t)sizeof(int));
-
-    if(bind(sock, p->ai_addr, p->ai_addrlen) == -1) {
-      perror(NULL);
-      close(sock);
-      continue;
-    }
-
-    // set up, break the loop
-    break;
+  if (ascii_header_get(buf, "SCIENCE_CASE", "%i", science_case) == -1) {
+    LOG("ERROR. SCIENCE_CASE not set in header\n");
+    header_incomplete = 1;
   }
-
-  if (p == NULL) {
-    fprintf(stderr, "Cannot setup connection\n" );
-    exit(EXIT_FAILURE);
+  if (ascii_header_get(buf, "SCIENCE_MODE", "%i", science_mode) == -1) {
+    LOG("ERROR. SCIENCE_CASE not set in header\n");
+    header_incomplete = 1;
+  }
+  if (ascii_header_get(buf, "PADDED_SIZE", "%i", padded_size) == -1) {
+    LOG("ERROR. PADDED_SIZE not set in header\n");
+    header_incomplete = 1;
   }
 
-  free(servinfo);
-
-  return sock;
+  LOG("psrdada HEADER: %s\n", header);
+  return header_incomplete ? -1 : 0;
 }
 
 /**
@@ -242,7 +521,6 @@ dada_hdu_t *init_ringbuffer(char *header, char *key, size_t *minimum_size, int *
   uint64_t bufsz;
   uint64_t nbufs;
   dada_hdu_t *hdu;
-  int header_incomplete = 0;
 
   key_t shmkey;
 
@@ -280,27 +558,7 @@ dada_hdu_t *init_ringbuffer(char *header, char *key, size_t *minimum_size, int *
   }
 
   // read header from file
-  if (fileread (header, buf, bufsz) < 0) { 
-    LOG("ERROR. Cannot read header from %s\n", header);
-    header_incomplete = 1;
-    exit(EXIT_FAILURE);
-  }
-
-  if (ascii_header_get(buf, "SCIENCE_CASE", "%i", science_case) == -1) {
-    LOG("ERROR. SCIENCE_CASE not set in header\n");
-    header_incomplete = 1;
-  }
-  if (ascii_header_get(buf, "SCIENCE_MODE", "%i", science_mode) == -1) {
-    LOG("ERROR. SCIENCE_CASE not set in header\n");
-    header_incomplete = 1;
-  }
-  if (ascii_header_get(buf, "PADDED_SIZE", "%i", padded_size) == -1) {
-    LOG("ERROR. PADDED_SIZE not set in header\n");
-    header_incomplete = 1;
-  }
-
-  LOG("psrdada HEADER: %s\n", header);
-  if (header_incomplete) {
+  if (read_header(header, buf, bufsz, science_case, science_mode, padded_size) < 0) {
     exit(EXIT_FAILURE);
   }
 
@@ -325,12 +583,216 @@ dada_hdu_t *init_ringbuffer(char *header, char *key, size_t *minimum_size, int *
   return hdu;
 }
 
+/**
+ * Write the header of the next observation to the ringbuffer
+ * The observation should have the same science case, science mode, and padded size as the first one
+ *
+ * @param {dada_hdu_t *} hdu Connected HDU
+ * @param {char *} header String containing the header file name to read
+ * @param {int} science_case Science case of the run
+ * @param {int} science_mode Science mode of the run
+ * @param {int} padded_size Padded size of the run
+ * @returns {int} 0 on success, -1 when the header cannot be used
+ */
+int write_header(dada_hdu_t *hdu, char *header, int science_case, int science_mode, int padded_size) {
+  uint64_t bufsz = ipcbuf_get_bufsz (hdu->header_block);
+  char *tmp = malloc(bufsz);
+  char *buf;
+  int next_case, next_mode, next_padded_size;
+
+  if (read_header(header, tmp, bufsz, &next_case, &next_mode, &next_padded_size) < 0) {
+    free(tmp);
+    return -1;
+  }
+  if (next_case != science_case || next_mode != science_mode || next_padded_size != padded_size) {
+    LOG("ERROR. Observation should have science case %i, mode %i, padded size %i; restart to change them\n", science_case, science_mode, padded_size);
+    free(tmp);
+    return -1;
+  }
+
+  // get write address
+  buf = ipcbuf_get_next_write (hdu->header_block);
+  if (! buf) {
+    LOG("ERROR. Get next header block error\n");
+    free(tmp);
+    return -1;
+  }
+  memcpy(buf, tmp, bufsz);
+  free(tmp);
+
+  // tell the ringbuffer the header is filled
+  if (ipcbuf_mark_filled (hdu->header_block, bufsz) < 0) {
+    LOG("ERROR. Could not mark filled header block\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Open the control fifo of the daemon mode, creating it when needed
+ * The fifo is opened for reading and writing, so it does not reach end-of-file when a writer closes it
+ *
+ * @param {char *} path Path of the fifo
+ * @returns {FILE *} The opened fifo
+ */
+FILE *open_control(char *path) {
+  struct stat st;
+  int fd;
+
+  if (stat(path, &st) != 0) {
+    if (mkfifo(path, 0660) != 0) {
+      LOG("ERROR. Cannot create control fifo %s: %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  } else if (!S_ISFIFO(st.st_mode)) {
+    LOG("ERROR. Control file %s is not a fifo\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  fd = open(path, O_RDWR);
+  if (fd < 0) {
+    LOG("ERROR. Cannot open control fifo %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  LOG("Reading observations from %s\n", path);
+  return fdopen(fd, "r");
+}
+
+/**
+ * Wait for the next observation on the control fifo
+ * An observation is a line '<header file> <start packet> <duration (s)>'
+ *
+ * @param {FILE *} control The control fifo
+ * @param {char **} header Set to the header file name, to be freed by the caller
+ * @param {unsigned long *} startpacket Set to the start packet
+ * @param {float *} duration Set to the duration
+ * @returns {int} 0 on success, -1 for an invalid line
+ */
+int next_observation(FILE *control, char **header, unsigned long *startpacket, float *duration) {
+  char line[PATH_MAX + 64];
+  char name[PATH_MAX];
+
+  if (!fgets(line, sizeof(line), control)) {
+    LOG("ERROR. Cannot read from the control fifo\n");
+    clean_exit(0);
+  }
+
+  if (sscanf(line, "%4095s %lu %f", name, startpacket, duration) != 3 || *duration <= 0) {
+    LOG("ERROR. Invalid observation: %s", line);
+    return -1;
+  }
+
+  *header = strdup(name);
+  return 0;
+}
+
+/**
+ * Prefault and lock all data blocks of the ringbuffer
+ * This moves the page faults on the first write to a new ringbuffer page to before the start of the observation.
+ * The pages are locked in memory if allowed (see RLIMIT_MEMLOCK), and otherwise populated.
+ * When the NUMA node of the network interface is known, the pages are checked to be on that node,
+ * and optionally bound to it first.
+ *
+ * @param {dada_hdu_t *} hdu The connected HDU
+ * @param {int} node NUMA node of the network interface, or -1 when unknown
+ * @param {int} bind Bind the pages to the node
+ */
+void prefault_ringbuffer(dada_hdu_t *hdu, int node, int bind) {
+  char **buffers;
+  uint64_t nbufs;
+  uint64_t bufsz;
+  uint64_t i, offset;
+  struct timespec start, end;
+  int locked = 1;
+  int lock_errno = 0;
+  int remote = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  buffers = dada_hdu_db_addresses(hdu, &nbufs, &bufsz);
+  for (i = 0; i < nbufs; i++) {
+    if (bind && bind_memory(buffers[i], bufsz, node) != 0) {
+      LOG("Warning: cannot bind ringbuffer page %lu to NUMA node %i: %s\n", i, node, strerror(errno));
+    }
+    if (locked && mlock(buffers[i], bufsz) == 0) {
+      continue;
+    }
+    if (locked) {
+      lock_errno = errno;
+      locked = 0;
+    }
+
+    // populate the page tables without changing the contents
+    if (madvise(buffers[i], bufsz, MADV_POPULATE_WRITE) != 0) {
+      for (offset = 0; offset < bufsz; offset += 4096) {
+        (void) *(volatile char *)&buffers[i][offset];
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  LOG("Prefaulted %lu ringbuffer pages of %lu bytes in %.3f s%s\n", nbufs, bufsz,
+      (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec), locked ? ", locked in memory" : "");
+  if (!locked) {
+    LOG("Warning: cannot lock the ringbuffer in memory: %s\n", strerror(lock_errno));
+  }
+
+  // check the pages are local to the network interface
+  if (node >= 0) {
+    for (i = 0; i < nbufs; i++) {
+      for (offset = 0; offset < bufsz; offset += bufsz / 8 + 1) {
+        if (memory_numa_node(&buffers[i][offset]) != node) {
+          remote++;
+          break;
+        }
+      }
+    }
+    if (remote) {
+      LOG("Warning: %i of %lu ringbuffer pages are not on NUMA node %i of the network interface%s\n", remote, nbufs, node,
+          bind ? "" : ", consider '-N'");
+    }
+  }
+}
+
 /**
  * Try to cleanly shut down, and singal end-of-data on the ring buffer, if possible
+ * Not a signal handler: on SIGTERM it is called by signal_run
+ * Only the first caller shuts down, any later caller just ends its thread
+ *
+ * @param {int} signum SIGTERM when stopped by a signal, 0 otherwise
  */
 void clean_exit(int signum) {
+  receiver_t *self = (receiver_t *)thread_receiver;
+  int expected;
+
+  // stop writing to the open pages, so a rotation in progress can finish
+  if (self) {
+    atomic_store(&self->hold, 0);
+  }
+
+  // only the first caller shuts down; the others stop their thread, letting go of the rotation lock
+  if (atomic_flag_test_and_set(&signal_exiting)) {
+    if (thread_rotating) {
+      thread_rotating = 0;
+      atomic_store(signal_rotating, 0);
+    }
+    pthread_exit(NULL);
+  }
+
   if (signum == SIGTERM) {
-    LOG("Received SIGTERM, shutting down");
+    LOG("Received SIGTERM, shutting down\n");
+  }
+
+  // take the rotation lock, so the ringbuffer is not changed by a rotation at the same time
+  if (signal_rotating && !thread_rotating) {
+    expected = 0;
+    while (!atomic_compare_exchange_weak(signal_rotating, &expected, 1)) {
+      expected = 0;
+      __builtin_ia32_pause();
+    }
+    thread_rotating = 1;
   }
 
   if (signal_hdu) {
@@ -339,11 +801,18 @@ void clean_exit(int signum) {
   }
 
   // clean up and exit
+  log_stop();
   fflush(stdout);
   fflush(stderr);
   fflush(runlog);
 
-  close(signal_sockfd);
+  int i;
+  for (i = 0; i < signal_nsockfd; i++) {
+    close(signal_sockfd[i]);
+  }
+  if (signal_quarantine) {
+    fclose(signal_quarantine);
+  }
   fclose(runlog);
 
   if (signum == SIGTERM) {
@@ -353,374 +822,684 @@ void clean_exit(int signum) {
   exit(EXIT_FAILURE);
 }
 
-int main(int argc, char** argv) {
-  // network state
-  int port;                 // port number
-  int sockfd = -1;          // socket file descriptor
-
-  // ringbuffer state
-  dada_hdu_t *hdu;
-  char *buf; // pointer to current buffer
+/**
+ * Wait for SIGTERM, and shut down cleanly
+ * SIGTERM is blocked in all other threads, so the shutdown runs here in normal context instead of in a signal handler,
+ * where logging, joining the logging thread, and closing files are not safe.
+ *
+ * @param {void *} arg The sigset_t with SIGTERM
+ */
+void *signal_run(void *arg) {
+  sigset_t *set = (sigset_t *)arg;
+  int signum;
 
-  // run parameters
-  float duration;          // run time in seconds
-  int science_case;        // 3 or 4
-  int science_mode;        // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
-  float missing_pct;       // Number of packets missed in percentage of expected number
-  int missing;             // Number of packets missed
-  unsigned long startpacket;           // Packet number to start (in units of TIMEUNIT since unix epoch)
-  unsigned long endpacket;             // Packet number to stop (excluded) (in units of TIMEUNIT since unix epoch)
-  int padded_size;
-  int freqissue_workaround = 0; // Do we need to work around the FREQISSUE bug?
+  while (sigwait(set, &signum) != 0) {
+  }
+  clean_exit(signum);
+  return NULL;
+}
 
-  // local vars
-  char *header;
-  char *key;
-  char *logfile;
-  const char mode = 'w';
-  size_t required_size = 0;
-  int ntabs = 0;
-  float done_pct;
-  int sequence_length; // number of packages belonging to a sequence
+/**
+ * Spin-wait hint for the busy loops below
+ */
+static inline void cpu_relax() {
+  __builtin_ia32_pause();
+}
 
-  packet_t packet_buffer[MMSG_VLEN];   // Buffer for batch requesting packets via recvmmsg
-  unsigned int packet_idx;             // Current packet index in MMSG buffer
-  struct iovec iov[MMSG_VLEN];         // IO vec structure for recvmmsg
-  struct mmsghdr msgs[MMSG_VLEN];      // multimessage hearders for recvmmsg
+/**
+ * Current time in milliseconds, for the page timeout
+ */
+static inline long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
 
-  packet_t *packet;                 // Pointer to current packet
-  unsigned char cb_index = 255;     // Current compound beam index (fixed per run)
-  unsigned short curr_channel;      // Current channel index
-  unsigned long curr_packet = 0;    // Current packet number (is number of packets after unix epoch)
-  unsigned long sequence_time;      // Timestamp for current sequnce
-  unsigned long packets_in_buffer;  // number of records processed per time segment
+/**
+ * Stop writing to the open pages
+ * The streaming stores of the payload copies are fenced first, so they are complete when a page is released
+ *
+ * @param {receiver_t *} self The receiver
+ */
+static inline void release_hold(receiver_t *self) {
+  stream_fence();
+  atomic_store(&self->hold, 0);
+}
 
-  // parse commandline
-  if (argc == 1) {
-    printOptions();
-    exit(EXIT_FAILURE);
+/**
+ * Add the missing packets of a page to the per tab and per channel statistics
+ * Should be called with the stats_lock held
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {atomic_ulong *} arrived Packet arrival mask of the page
+ */
+static void count_missing(ringstate_t *ring, atomic_ulong *arrived) {
+  int nwords = (ring->nslots + 63) / 64;
+  int slots_per_tab = ring->nslots / ring->ntabs;
+  int channels_per_slot = NCHANNELS / (slots_per_tab / ring->sequence_length);
+  unsigned long missing;
+  int slot, tab;
+  int i;
+
+  // packet slots are [tab][channel][sequence_number], with four channels per slot for Stokes IQUV
+  for (i = 0; i < nwords; i++) {
+    missing = ~atomic_load_explicit(&arrived[i], memory_order_relaxed);
+    if (i == nwords - 1 && ring->nslots % 64) {
+      missing &= (1UL << (ring->nslots % 64)) - 1;
+    }
+    while (missing) {
+      slot = i * 64 + __builtin_ctzl(missing);
+      missing &= missing - 1;
+
+      tab = slot / slots_per_tab;
+      if (tab < STATS_MAX_TABS) {
+        ring->totals.missing_tab[tab]++;
+      }
+      ring->totals.missing_channel[(slot % slots_per_tab) / ring->sequence_length * channels_per_slot]++;
+    }
   }
-  parseOptions(argc, argv, &header, &key, &startpacket, &duration, &port, &logfile, &freqissue_workaround);
+}
 
-  // set up logging
-  if (logfile) {
-    runlog = fopen(logfile, &mode);
-    if (! runlog) {
-      LOG("ERROR opening logfile: %s\n", logfile);
-      exit(EXIT_FAILURE);
+/**
+ * Add a page rotation to the run statistics
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {struct timespec *} started Time the rotation started (CLOCK_MONOTONIC)
+ */
+static void count_rotation(ringstate_t *ring, struct timespec *started) {
+  struct timespec now;
+  unsigned long ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ns = (now.tv_sec - started->tv_sec) * 1000000000L + (now.tv_nsec - started->tv_nsec);
+
+  pthread_mutex_lock(&ring->stats_lock);
+  ring->totals.rotations++;
+  ring->totals.rotation_ns += ns;
+  if (ns > ring->totals.rotation_ns_max) {
+    ring->totals.rotation_ns_max = ns;
+  }
+  pthread_mutex_unlock(&ring->stats_lock);
+}
+
+/**
+ * Collect the receive times of the oldest open page from the receivers, and log its arrival latency
+ * Only called from release_page, when no receiver holds the pages
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {page_t *} page The oldest open page
+ */
+static void log_arrivals(ringstate_t *ring, page_t *page) {
+  histogram_t latency;
+  unsigned long early = 0;
+  unsigned long first = 0;
+  unsigned long last = 0;
+  int i;
+
+  hist_reset(&latency);
+  for (i = 0; i < nreceivers; i++) {
+    arrivals_t *arrivals = &receivers[i].arrivals[ring->first];
+
+    if (arrivals->first) {
+      hist_merge(&latency, &arrivals->latency);
+      early += arrivals->early;
+      if (!first || arrivals->first < first) {
+        first = arrivals->first;
+      }
+      if (arrivals->last > last) {
+        last = arrivals->last;
+      }
     }
-    LOG("Logging to logfile: %s\n", logfile);
-    free (logfile);
+    hist_reset(&arrivals->latency);
+    arrivals->early = 0;
+    arrivals->first = 0;
+    arrivals->last = 0;
   }
-  LOG("fill ringbuffer version: " VERSION "\n");
 
-  // ring buffer
-  LOG("Connecting to ringbuffer\n");
-  hdu = init_ringbuffer(header, key, &required_size, &science_case, &science_mode, &padded_size); // sets required_size to actual size
+  if (latency.n == 0) {
+    return;
+  }
+  hist_add(&ring->spread, last - first);
 
-  free(header); header = NULL;
-  free(key); key = NULL;
+  LOG("Arrival of time %lu: latency p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms, first to last packet %.3f ms, early: %lu\n",
+      page->timestamp, 1e-6 * hist_percentile(&latency, 50.0), 1e-6 * hist_percentile(&latency, 99.0),
+      1e-6 * hist_percentile(&latency, 99.9), 1e-6 * latency.max, 1e-6 * (last - first), early);
+}
 
-  // calculate run length
-  endpacket = startpacket + lroundf(duration * TIMEUNIT);
-  LOG("Science case = %i\n", science_case);
-  LOG("Science mode = %i [ %s ]\n", science_mode, science_modes[science_mode]);
-  LOG("Start time (unix time) = %lu\n", startpacket / TIMEUNIT);
-  LOG("End time (unix time) = %lu\n", endpacket / TIMEUNIT);
-  LOG("Duration (s) = %f\n", duration);
-  LOG("Start packet = %lu\n", startpacket);
-  LOG("End packet = %lu\n", endpacket);
-
-  unsigned char expected_marker_byte = 0;
-  int packets_per_sample = 0;
-  unsigned short expected_payload = 0;
-  if (science_case == 3) {
-    switch (science_mode) {
-      case 0:
-        expected_marker_byte = 0xD0; // I with TAB
-        ntabs = 9;
-        sequence_length = 2;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC3 * 1 / PAYLOADSIZE_STOKESI;
-        expected_payload = PAYLOADSIZE_STOKESI;
-        required_size = ntabs * NCHANNELS * padded_size;
-        break;
-
-      case 1:
-        expected_marker_byte = 0xD1; // IQUV with TAB
-        ntabs = 9;
-        sequence_length = 25;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC3 * 4 / PAYLOADSIZE_STOKESIQUV;
-        expected_payload = PAYLOADSIZE_STOKESIQUV;
-        required_size = ntabs * NCHANNELS * PACKETRATESC3 * 4;
-        break;
-
-      case 2:
-        expected_marker_byte = 0xD2; // I with IAB
-        ntabs = 1;
-        sequence_length = 2;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC3 * 1 / PAYLOADSIZE_STOKESI;
-        expected_payload = PAYLOADSIZE_STOKESI;
-        required_size = ntabs * NCHANNELS * padded_size;
-        break;
-
-      case 3:
-        expected_marker_byte = 0xD3; // IQUV with IAB
-        ntabs = 1;
-        sequence_length = 25;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC3 * 4 / PAYLOADSIZE_STOKESIQUV;
-        expected_payload = PAYLOADSIZE_STOKESIQUV;
-        required_size = ntabs * NCHANNELS * PACKETRATESC3 * 4;
-        break;
+/**
+ * Log the distribution of the time between the first and the last packet of the pages of an observation
+ *
+ * @param {ringstate_t *} ring Shared state
+ */
+static void log_spread(ringstate_t *ring) {
+  if (ring->spread.n) {
+    LOG("First to last packet of %lu pages: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", ring->spread.n,
+        1e-6 * hist_percentile(&ring->spread, 50.0), 1e-6 * hist_percentile(&ring->spread, 99.0), 1e-6 * ring->spread.max);
+  }
+  hist_reset(&ring->spread);
+}
 
-      default:
-        fprintf(stderr, "Illegal science mode: '%i'\n", science_mode);
-        exit(EXIT_FAILURE);
-        break;
+/**
+ * Mark the oldest open page as filled, and print diagnostics
+ * Only called from rotate_page, when no receiver holds the pages
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {receiver_t *} self The calling receiver
+ * @param {int} eod Set End-Of-Data on the ringbuffer before marking the page filled
+ */
+void release_page(ringstate_t *ring, receiver_t *self, int eod) {
+  page_t *page = &ring->pages[ring->first];
+  atomic_ulong *arrived = ring->arrived[ring->first];
+  int nwords = (ring->nslots + 63) / 64;
+  unsigned long packets_in_buffer;  // number of records processed per time segment
+  unsigned long late;               // number of packets that arrived after their page was released
+  unsigned long duplicates;         // number of packets received more than once
+  unsigned long bad[NBAD];          // number of packets with a bad header, per reason
+  unsigned long nbad;               // total number of packets with a bad header
+  unsigned long drops;              // number of packets dropped by the kernel
+  char bad_details[128];            // the non-zero counters of bad packets
+  int len;
+  int missing;                      // Number of packets missed
+  float missing_pct;                // Number of packets missed in percentage of expected number
+  float done_pct;
+  int i;
+
+  //  - count the packets from the arrival mask, and copy it to the trailer
+  packets_in_buffer = 0;
+  for (i = 0; i < nwords; i++) {
+    packets_in_buffer += __builtin_popcountl(atomic_load_explicit(&arrived[i], memory_order_relaxed));
+  }
+  if (ring->fill) {
+    fill_missing(page->buf, (unsigned long *)arrived, &ring->layout, ring->fill_value);
+  }
+  if (ring->mask_trailer) {
+    memcpy(&page->buf[ring->required_size], arrived, nwords * sizeof(unsigned long));
+  }
+
+  if (eod) {
+    // set End-Of-Data on the ringbuffer to have a clean shutdown of the pipeline
+    ipcbuf_enable_eod((ipcbuf_t *)ring->hdu->data_block);
+  }
+
+  //  - mark the ringbuffer as filled
+  if (ipcbuf_mark_filled ((ipcbuf_t *)ring->hdu->data_block, ring->required_size + (ring->mask_trailer ? nwords * sizeof(unsigned long) : 0)) < 0) {
+    LOG("ERROR: cannot mark buffer as filled\n");
+    clean_exit(0);
+  }
+
+  //  - collect and reset the packet counters
+  late = 0;
+  duplicates = 0;
+  drops = 0;
+  memset(bad, 0, sizeof(bad));
+  for (i = 0; i < nreceivers; i++) {
+    unsigned long kernel_drops = capture_drops(&receivers[i].capture);
+    int r;
+
+    drops += kernel_drops - receivers[i].drops_released;
+    receivers[i].drops_released = kernel_drops;
+
+    late += atomic_exchange(&receivers[i].late, 0);
+    duplicates += atomic_exchange(&receivers[i].duplicates, 0);
+    for (r = 0; r < NBAD; r++) {
+      bad[r] += atomic_exchange(&receivers[i].bad[r], 0);
     }
-  } else if (science_case == 4) {
-    switch (science_mode) {
-      case 0:
-        expected_marker_byte = 0xE0; // I with TAB
-        ntabs = 12;
-        sequence_length = 2;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC4 * 1 / PAYLOADSIZE_STOKESI;
-        expected_payload = PAYLOADSIZE_STOKESI;
-        required_size = ntabs * NCHANNELS * padded_size;
-        break;
+  }
 
-      case 1:
-        expected_marker_byte = 0xE1; // IQUV with TAB
-        ntabs = 12;
-        sequence_length = 25;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC4 * 4 / PAYLOADSIZE_STOKESIQUV;
-        expected_payload = PAYLOADSIZE_STOKESIQUV;
-        required_size = ntabs * NCHANNELS * PACKETRATESC4 * 4;
-        break;
+  nbad = 0;
+  len = 0;
+  bad_details[0] = '\0';
+  for (i = 0; i < NBAD; i++) {
+    nbad += bad[i];
+    if (bad[i] && len < sizeof(bad_details)) {
+      len += snprintf(&bad_details[len], sizeof(bad_details) - len, "%s%s: %lu", len ? ", " : " (", bad_reasons[i], bad[i]);
+    }
+  }
+  if (len && len < sizeof(bad_details)) {
+    snprintf(&bad_details[len], sizeof(bad_details) - len, ")");
+  }
 
-      case 2:
-        expected_marker_byte = 0xE2; // I with IAB
-        ntabs = 1;
-        sequence_length = 2;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC4 * 1 / PAYLOADSIZE_STOKESI;
-        expected_payload = PAYLOADSIZE_STOKESI;
-        required_size = ntabs * NCHANNELS * padded_size;
-        break;
+  // - print diagnostics
+  missing = ring->packets_per_sample - packets_in_buffer;
+  missing_pct = (100.0 * missing) / (1.0 * ring->packets_per_sample);
+  done_pct = 100.0 * (1.0 * page->timestamp - ring->startpacket) / (ring->endpacket - ring->startpacket);
+  LOG("Compound beam %4i: time %li (%6.2f%%), missing: %6.3f%% (%i), kernel drops: %lu, late: %lu, duplicates: %lu, bad: %lu%s\n",
+      self->cb_index, page->timestamp, done_pct, missing_pct, missing, drops, late, duplicates, nbad, bad_details);
 
-      case 3:
-        expected_marker_byte = 0xE3; // IQUV with IAB
-        ntabs = 1;
-        sequence_length = 25;
-        packets_per_sample = ntabs * NCHANNELS * PACKETRATESC4 * 4 / PAYLOADSIZE_STOKESIQUV;
-        expected_payload = PAYLOADSIZE_STOKESIQUV;
-        required_size = ntabs * NCHANNELS * PACKETRATESC4 * 4;
-        break;
+  if (ring->timestamps) {
+    log_arrivals(ring, page);
+  }
 
-      default:
-        fprintf(stderr, "Illegal science mode: '%i'\n", science_mode);
-        exit(EXIT_FAILURE);
-        break;
+  // - add to the run statistics
+  if (ring->stats) {
+    pthread_mutex_lock(&ring->stats_lock);
+    ring->totals.timestamp = page->timestamp;
+    ring->totals.pages++;
+    ring->totals.expected += ring->packets_per_sample;
+    ring->totals.missing += missing;
+    ring->totals.kernel_drops += drops;
+    ring->totals.late += late;
+    ring->totals.duplicates += duplicates;
+    for (i = 0; i < NBAD; i++) {
+      ring->totals.bad[i] += bad[i];
     }
-  } else {
-    LOG("Science case not supported");
-    exit(EXIT_FAILURE);
+    count_missing(ring, arrived);
+    pthread_mutex_unlock(&ring->stats_lock);
   }
 
-  LOG("Expected marker byte= 0x%X\n", expected_marker_byte);
-  LOG("Expected payload = %i B\n", expected_payload);
-  LOG("Packets per sample = %i\n", packets_per_sample);
+  ring->first = (ring->first + 1) % MAX_WINDOW;
+  ring->npages--;
 
-  // sockets
-  LOG("Opening network port %i\n", port);
-  sockfd = init_network(port);
+  // the next open page becomes the current dada page
+  if (ring->npages > 0 && !eod) {
+    char *buf = ipcbuf_get_next_write ((ipcbuf_t *)ring->hdu->data_block);
+    if (buf != ring->pages[ring->first].buf) {
+      LOG("ERROR: unexpected ringbuffer page order\n");
+      clean_exit(0);
+    }
+  }
+}
 
-  // multi message setup
-  memset(msgs, 0, sizeof(msgs));
-  for(packet_idx=0; packet_idx < MMSG_VLEN; packet_idx++) {
-    iov[packet_idx].iov_base = (char *) &packet_buffer[packet_idx];
-    iov[packet_idx].iov_len = expected_payload + PACKHEADER;
+/**
+ * Can we write to the dada page 'ahead' pages after the current one?
+ * The page should be cleared by the readers, and not be the current page.
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {int} ahead Number of pages after the current one
+ * @returns {char *} The page, or NULL when it is not available
+ */
+char *lookahead_page(ringstate_t *ring, int ahead) {
+  ipcbuf_t *db = (ipcbuf_t *)ring->hdu->data_block;
+  uint64_t nbufs = ipcbuf_get_nbufs(db);
 
-    msgs[packet_idx].msg_hdr.msg_name    = NULL; // we don't need to know who sent the data
-    msgs[packet_idx].msg_hdr.msg_iov     = &iov[packet_idx];
-    msgs[packet_idx].msg_hdr.msg_iovlen  = 1;
-    msgs[packet_idx].msg_hdr.msg_control = NULL; // we're not interested in OoB data
+  if (ahead >= nbufs || ipcbuf_get_nclear(db) <= ahead) {
+    return NULL;
   }
+  return db->buffer[(ipcbuf_get_write_count(db) + ahead) % nbufs];
+}
 
-  // clear packet counters
-  packets_in_buffer = 0;
+/**
+ * Time to end the observation when no packets past its end arrive: the page timeout after the end time
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {unsigned long} timestamp A timestamp before the end
+ * @param {long} at Time (ms) of that timestamp
+ * @returns {long} The time (ms) to end the observation
+ */
+static long end_time_ms(ringstate_t *ring, unsigned long timestamp, long at) {
+  return at + (long) ((ring->endpacket - timestamp) * TIMEUNIT_NS / 1000000) + (ring->timeout ? ring->timeout : END_TIMEOUT);
+}
 
-  // start at the end of the packet buffer, so the main loop starts with a recvmmsg call
-  packet_idx = MMSG_VLEN - 1;
-  packet = &packet_buffer[packet_idx];
+/**
+ * Open a new ringbuffer page for the given timestamp, releasing old pages when needed,
+ * or release the oldest page on timeout (timestamp 0).
+ *
+ * Only one thread does the rotation, the other threads wait till it is done.
+ * The pages are changed once no receiver holds them anymore.
+ *
+ * @param {receiver_t *} self The calling receiver
+ * @param {unsigned long} timestamp Timestamp of the packet that starts the new page, or 0 to check the timeout
+ */
+void rotate_page(receiver_t *self, unsigned long timestamp) {
+  ringstate_t *ring = self->ring;
+  struct timespec started;
+  page_t *page;
+  char *buf;
+  int expected = 0;
+  int i;
 
-  //  get a new buffer
-  buf = ipcbuf_get_next_write ((ipcbuf_t *)hdu->data_block);
-  packets_in_buffer = 0;
-  sequence_time = curr_packet;
-
-  // ============================================================
-  // idle till start time, but keep track of which bands there are
-  // ============================================================
- 
-  curr_packet = 0;
-  packet_idx = MMSG_VLEN - 1;
-  while (curr_packet < startpacket) {
-    // go to next packet in the packet buffer
-    packet_idx++;
-
-    // did we reach the end of the packet buffer?
-    if (packet_idx == MMSG_VLEN) {
-      // read new packets from the network into the buffer
-      if(recvmmsg(sockfd, msgs, MMSG_VLEN, 0, NULL) != MMSG_VLEN) {
-        LOG("ERROR Could not read packets\n");
-        clean_exit(0);
-      }
-      // go to start of buffer
-      packet_idx = 0;
+  // stop writing to the open pages
+  release_hold(self);
+
+  // let a single thread rotate the pages
+  if (!atomic_compare_exchange_strong(&ring->rotating, &expected, 1)) {
+    while (atomic_load(&ring->rotating)) {
+      cpu_relax();
     }
-    packet = &packet_buffer[packet_idx];
+    return;
+  }
+  thread_rotating = 1;
 
-    // keep track of compound beams
-    cb_index = packet->cb_index;
+  // the observation ended while we were waiting
+  if (!atomic_load(&ring->running)) {
+    thread_rotating = 0;
+    atomic_store(&ring->rotating, 0);
+    return;
+  }
+  if (ring->stats) {
+    clock_gettime(CLOCK_MONOTONIC, &started);
+  }
 
-    // keep track of timestamps
-    curr_packet = bswap_64(packet->timestamp);
+  // wait till the other threads have stopped writing to the open pages
+  for (i = 0; i < nreceivers; i++) {
+    while (atomic_load(&receivers[i].hold)) {
+      cpu_relax();
+    }
+  }
 
-    if (curr_packet != sequence_time) {
-      printf( "Current packet is %li\n", curr_packet);
-      sequence_time = curr_packet;
+  if (timestamp == 0) {
+    // release the oldest page when the next page has been open long enough
+    if (ring->npages > 1 && now_ms() - ring->pages[(ring->first + 1) % MAX_WINDOW].opened >= ring->timeout) {
+      release_page(ring, self, 0);
+    }
+  } else if (ring->npages > 0 && timestamp <= ring->pages[(ring->first + ring->npages - 1) % MAX_WINDOW].timestamp) {
+    // another thread opened the page already
+  } else if (timestamp >= ring->endpacket) {
+    // start of a new time segment past the end:
+    // release the open pages, set End-Of-Data on the last one, and stop
+    if (ring->initial_buf) {
+      // the first packet was already past the end: end the transfer with an empty page
+      LOG("Warning: observation ended before it started\n");
+      ipcbuf_enable_eod((ipcbuf_t *)ring->hdu->data_block);
+      ipcbuf_mark_filled((ipcbuf_t *)ring->hdu->data_block, 0);
+      ring->initial_buf = NULL;
+    }
+    while (ring->npages > 0) {
+      release_page(ring, self, ring->npages == 1);
+    }
+    if (ring->timestamps) {
+      log_spread(ring);
+    }
+    if (self->capture.backend == CAPTURE_FILE) {
+      capture_report_file(&self->capture);
+    }
+    if (!ring->daemon_mode) {
+      clean_exit(0);
+    }
+
+    // daemon mode: send the receivers back to idle till the next observation
+    atomic_store(&ring->end_deadline, 0);
+    signal_hdu = NULL;
+    atomic_store(&ring->startpacket, NO_OBSERVATION);
+    atomic_store(&ring->running, 0);
+    LOG("Observation finished\n");
+  } else {
+    if (ring->initial_buf) {
+      // first page; it was requested before starting the receivers
+      // Try to do a clean exit on SIGTERM
+      signal_hdu = ring->hdu;
+      signal_required_size = ring->required_size;
+
+      LOG("STARTING WITH CB_INDEX=%i\n", self->cb_index);
+      buf = ring->initial_buf;
+      ring->initial_buf = NULL;
+
+      // count kernel drops from here, not the ones of the idle sampling
+      for (i = 0; i < nreceivers; i++) {
+        receivers[i].drops_released = capture_drops(&receivers[i].capture);
+      }
+
+      // timestamps that are not the current time, like a test stream: end on time counting from the first page
+      if (!atomic_load(&ring->end_deadline) && self->capture.backend != CAPTURE_FILE) {
+        atomic_store(&ring->end_deadline, end_time_ms(ring, timestamp, now_ms()));
+      }
+    } else {
+      // start of a new time segment:
+      // release the oldest pages till there is room for the new page
+      buf = NULL;
+      while (ring->npages > 0 && (ring->npages >= ring->window || !(buf = lookahead_page(ring, ring->npages)))) {
+        release_page(ring, self, 0);
+      }
+      if (ring->npages == 0) {
+        //  - get a new buffer
+        buf = ipcbuf_get_next_write ((ipcbuf_t *)ring->hdu->data_block);
+      }
     }
+
+    page = &ring->pages[(ring->first + ring->npages) % MAX_WINDOW];
+    memset(ring->arrived[(ring->first + ring->npages) % MAX_WINDOW], 0, (ring->nslots + 63) / 64 * sizeof(unsigned long));
+    page->buf = buf;
+    page->timestamp = timestamp;
+    page->opened = now_ms();
+    ring->npages++;
   }
 
-  // process the first (already-read) package by moving the packet_idx one back
-  // this to compensate for the packet_idx++ statement in the first pass of the mainloop
-  packet_idx--;
+  // set the timeout for the oldest page
+  if (ring->timeout && ring->npages > 1) {
+    atomic_store(&ring->deadline, ring->pages[(ring->first + 1) % MAX_WINDOW].opened + ring->timeout);
+  } else {
+    atomic_store(&ring->deadline, 0);
+  }
 
-  // Try to do a clean exit on SIGTERM
-  signal_hdu = hdu;
-  signal_sockfd = sockfd;
-  signal_required_size = required_size;
-  signal(SIGTERM, clean_exit);
+  if (ring->stats) {
+    count_rotation(ring, &started);
+  }
 
-  LOG("STARTING WITH CB_INDEX=%i\n", cb_index);
+  // publish the new pages
+  atomic_fetch_add(&ring->generation, 1);
+  thread_rotating = 0;
+  atomic_store(&ring->rotating, 0);
+}
 
-  // ============================================================
-  // run till end time
-  // ============================================================
+/**
+ * Release the oldest page when its timeout has expired, and end the observation
+ * when it is past its end time and the stream has stopped
+ *
+ * @param {receiver_t *} self The calling receiver
+ */
+static inline void check_timeout(receiver_t *self) {
+  ringstate_t *ring = self->ring;
+  long deadline = atomic_load_explicit(&ring->deadline, memory_order_relaxed);
+  long end = atomic_load_explicit(&ring->end_deadline, memory_order_relaxed);
+
+  if (end && now_ms() >= end && atomic_compare_exchange_strong(&ring->end_deadline, &end, 0)) {
+    LOG("Warning: no packets after the end time, ending the observation\n");
+    rotate_page(self, ring->endpacket);
+  } else if (deadline && now_ms() >= deadline) {
+    rotate_page(self, 0);
+  }
+}
 
-  while (1) { // loop is terminated by break statement below
-    // go to next packet in the packet buffer
-    packet_idx++;
+/**
+ * Get the ringbuffer page to write a packet to, opening a new page when needed
+ *
+ * @param {receiver_t *} self The calling receiver
+ * @param {unsigned long} timestamp Timestamp of the packet
+ * @param {int *} page_slot Set to the slot of the page in the window
+ * @returns {char *} The page, or NULL when the packet belongs to an already released page
+ */
+char *enter_page(receiver_t *self, unsigned long timestamp, int *page_slot) {
+  ringstate_t *ring = self->ring;
+  unsigned long generation;
+  page_t *page;
+  int i;
+
+  while (1) {
+    // drop packets that arrive after the end of the observation
+    if (!atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+      return NULL;
+    }
 
-    // did we reach the end of the packet buffer?
-    if (packet_idx == MMSG_VLEN) {
-      // read new packets from the network into the buffer
-      if(recvmmsg(sockfd, msgs, MMSG_VLEN, 0, NULL) != MMSG_VLEN) {
-        LOG("ERROR Could not read packets\n");
-        clean_exit(0);
+    // let a rotation in progress finish
+    if (atomic_load_explicit(&ring->rotating, memory_order_relaxed)) {
+      release_hold(self);
+      while (atomic_load(&ring->rotating)) {
+        cpu_relax();
       }
-      // go to start of buffer
-      packet_idx = 0;
     }
-    packet = &packet_buffer[packet_idx];
 
-    // check marker byte
-    if (packet->marker_byte != expected_marker_byte) {
-      LOG("ERROR: wrong marker byte: %x instead of %x\n", packet->marker_byte, expected_marker_byte);
-      clean_exit(0);
+    // announce we are writing to the open pages, and check that no rotation started in between
+    generation = atomic_load(&ring->generation);
+    if (atomic_load_explicit(&self->hold, memory_order_relaxed) != generation) {
+      atomic_store(&self->hold, generation);
+      if (atomic_load(&ring->rotating) || atomic_load(&ring->generation) != generation) {
+        continue;
+      }
     }
 
-    // check version
-    if (packet->format_version != 1) {
-      LOG("ERROR: wrong format version: %d instead of %d\n", packet->format_version, 1);
-      clean_exit(0);
+    // find the page for this timestamp
+    for (i = 0; i < ring->npages; i++) {
+      page = &ring->pages[(ring->first + i) % MAX_WINDOW];
+      if (page->timestamp == timestamp) {
+        *page_slot = (ring->first + i) % MAX_WINDOW;
+        return page->buf;
+      }
     }
 
-    // check compound beam index 
-    if (packet->cb_index != cb_index) {
-      LOG("ERROR: unexpected compound beam index %d\n", packet->cb_index);
-      clean_exit(0);
+    if (ring->npages == 0 || timestamp > ring->pages[(ring->first + ring->npages - 1) % MAX_WINDOW].timestamp) {
+      // start of a new time segment
+      rotate_page(self, timestamp);
+      continue;
     }
 
-    // check tab index 
-    if (packet->tab_index >= ntabs) {
-      LOG("ERROR: unexpected tab index %d\n", packet->tab_index);
-      clean_exit(0);
-    }
+    // packet belongs to a previous sequence, but we have already released that dada ringbuffer page
+    atomic_fetch_add_explicit(&self->late, 1, memory_order_relaxed);
+    return NULL;
+  }
+}
 
-    // check channel
-    curr_channel = bswap_16(packet->channel_index);
-    if (curr_channel >= NCHANNELS) {
-      LOG("ERROR: unexpected channel index %d\n", curr_channel);
-      clean_exit(0);
-    }
+/**
+ * Count a packet with a bad header
+ * Only the first bad packet per reason per page is logged, so a misconfigured sender does not flood the log.
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {int} reason Why the packet is bad, one of the BAD_ constants
+ * @returns {int} Should the packet be logged
+ */
+int reject_packet(receiver_t *self, int reason) {
+  ringstate_t *ring = self->ring;
+  int first = atomic_fetch_add_explicit(&self->bad[reason], 1, memory_order_relaxed) == 0;
 
-    // check payload size
-    if (packet->payload_size != bswap_16(expected_payload)) {
-      LOG("Warning: unexpected payload size %d\n", bswap_16(packet->payload_size));
-      clean_exit(0);
+  if (ring->policy == POLICY_ABORT) {
+    long second = now_ms() / 1000;
+    long current = atomic_load(&ring->bad_second);
+
+    if (second != current && atomic_compare_exchange_strong(&ring->bad_second, &current, second)) {
+      atomic_store(&ring->bad_in_second, 0);
+    }
+    if (atomic_fetch_add(&ring->bad_in_second, 1) + 1 > ring->abort_limit) {
+      first = 1;
     }
+  }
 
-    // check timestamps
-    curr_packet = bswap_64(packet->timestamp);
-    if (curr_packet > sequence_time) {
-      // start of a new time segment:
-      // - check if this is the last data to process, 
-      if (curr_packet >= endpacket) {
-        // set End-Of-Data on the ringbuffer to have a clean shutdown of the pipeline
-        ipcbuf_enable_eod((ipcbuf_t *)hdu->data_block);
-      }
+  return first;
+}
 
-      //  - mark the ringbuffer as filled
-      if (ipcbuf_mark_filled ((ipcbuf_t *)hdu->data_block, required_size) < 0) {
-        LOG("ERROR: cannot mark buffer as filled\n");
-        clean_exit(0);
-      }
+/**
+ * Stop the run when the abort policy says so; called after the bad packet has been logged
+ *
+ * @param {receiver_t *} self The receiver
+ */
+void abort_on_bad_packets(receiver_t *self) {
+  ringstate_t *ring = self->ring;
 
-      // - print diagnostics
-      missing = packets_per_sample - packets_in_buffer;
-      missing_pct = (100.0 * missing) / (1.0 * packets_per_sample);
-      done_pct = 100.0 * (1.0 * curr_packet - startpacket) / (endpacket - startpacket);
-      LOG("Compound beam %4i: time %li (%6.2f%%), missing: %6.3f%% (%i)\n", cb_index, curr_packet, done_pct, missing_pct, missing);
+  if (ring->policy == POLICY_ABORT && atomic_load(&ring->bad_in_second) > ring->abort_limit) {
+    LOG("ERROR: more than %i packets with a bad header in one second\n", ring->abort_limit);
+    clean_exit(0);
+  }
+}
 
-      //  - reset the packets counter and sequence time
-      packets_in_buffer = 0;
-      sequence_time = curr_packet;
+/**
+ * Count the packets the capture dropped for being shorter than a header and payload as bad packets
+ *
+ * @param {receiver_t *} self The receiver
+ */
+void reject_short_packets(receiver_t *self) {
+  capture_t *cap = &self->capture;
+  int log = 0;
+  unsigned long i;
 
-      // - stop when we have reached (or passed..) end packet
-      if (curr_packet >= endpacket) {
-        clean_exit(0);
-      } else {
-        //  - get a new buffer
-        buf = ipcbuf_get_next_write ((ipcbuf_t *)hdu->data_block);
-      }
-    } else if (curr_packet < sequence_time) {
-      // packet belongs to previous sequence, but we have already released that dada ringbuffer page
-      continue;
+  for (i = 0; i < cap->short_packets; i++) {
+    log |= reject_packet(self, BAD_PAYLOAD);
+  }
+  if (log) {
+    LOG("Warning: %lu packets shorter than %li bytes\n", cap->short_packets, (long) cap->packet_size);
+  }
+  cap->short_packets = 0;
+  abort_on_bad_packets(self);
+}
+
+/**
+ * Write a packet with a bad header to the quarantine file, when that is the policy for bad packets
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {packet_t *} packet The packet
+ */
+void quarantine_packet(receiver_t *self, packet_t *packet) {
+  ringstate_t *ring = self->ring;
+
+  if (ring->policy == POLICY_QUARANTINE) {
+    // stdio locks the stream, so the receivers can share it
+    fwrite(packet, APPHEADER + ring->expected_payload, 1, ring->quarantine);
+  }
+}
+
+/**
+ * Check a packet header against the run parameters
+ * Bad packets are counted and logged; the run is stopped when the policy for bad packets says so
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {packet_t *} packet The packet
+ * @returns {int} The channel index of the packet, or -1 for a bad packet
+ */
+int check_packet(receiver_t *self, packet_t *packet) {
+  ringstate_t *ring = self->ring;
+  int reason;
+
+  reason = check_header(&self->check, packet);
+  if (reason < 0) {
+    return bswap_16(packet->channel_index);
+  }
+
+  if (reject_packet(self, reason)) {
+    switch (reason) {
+      case BAD_MARKER:
+        LOG("Warning: wrong marker byte: %x instead of %x\n", packet->marker_byte, ring->expected_marker_byte);
+        break;
+      case BAD_VERSION:
+        LOG("Warning: wrong format version: %d instead of %d\n", packet->format_version, 1);
+        break;
+      case BAD_CB:
+        LOG("Warning: unexpected compound beam index %d\n", packet->cb_index);
+        break;
+      case BAD_TAB:
+        LOG("Warning: unexpected tab index %d\n", packet->tab_index);
+        break;
+      case BAD_CHANNEL:
+        LOG("Warning: unexpected channel index %d\n", bswap_16(packet->channel_index));
+        break;
+      case BAD_SEQUENCE:
+        LOG("Warning: unexpected sequence number %d\n", packet->sequence_number);
+        break;
+      case BAD_PAYLOAD:
+        LOG("Warning: unexpected payload size %d\n", bswap_16(packet->payload_size));
+        break;
     }
+  }
+  abort_on_bad_packets(self);
+  return -1;
+}
 
-    // copy to ringbuffer
-    if ((science_mode & 1) == 0) {
+/**
+ * Find the packet slot of a packet: its index in the page, in the order of the ringbuffer layout
+ * Inlined with a constant placement, the layout constants fold into the address computation.
+ *
+ * @param {int} placement PLACEMENT_* layout of the page
+ * @param {packet_t *} packet The packet header
+ * @param {unsigned short} curr_channel Channel index of the packet
+ * @returns {int} The packet slot, or -1 if the payload should be dropped
+ */
+static inline __attribute__((always_inline)) int slot_in_layout(int placement, packet_t *packet, unsigned short curr_channel) {
+  switch (placement) {
+    case PLACEMENT_STOKESI_REMAPPED:
+      // Work around the FREQISSUE described above
+      curr_channel = remap_frequency_sc4[curr_channel];
+
+      if (curr_channel == 9999) {
+        return -1;
+      }
+      // fall through
+    case PLACEMENT_STOKESI:
       // stokes I
       // packets contains: timeseries of PAYLOADSIZE_STOKESI elements [t0 .. tn]
       //
       // ring buffer contains matrix:
       // [ntabs][NCHANNELS][PAYLOADSIZE_STOKESI]
+      //
+      // packet slots: [ntabs][NCHANNELS][sequence_length]
+      return ((packet->tab_index * NCHANNELS) + curr_channel) * STOKESI_SEQUENCE_LENGTH + packet->sequence_number;
 
-      if (freqissue_workaround) {
-        // Work around the FREQISSUE described above
-        curr_channel = remap_frequency_sc4[curr_channel];
-
-        if (curr_channel != 9999) {
-          memcpy(
-            &buf[((packet->tab_index * NCHANNELS) + curr_channel) * padded_size + packet->sequence_number * PAYLOADSIZE_STOKESI],
-            packet->record, PAYLOADSIZE_STOKESI);
-        }
-      } else {
-        memcpy(
-          &buf[((packet->tab_index * NCHANNELS) + curr_channel) * padded_size + packet->sequence_number * PAYLOADSIZE_STOKESI],
-          packet->record, PAYLOADSIZE_STOKESI);
-      }
-    } else {
+    default:
       // stokes IQUV
       // packets contains matrix: [t0 .. t499][c0 .. c3][the 4 components IQUV] total of 500*4*4=8000 bytes
       // t0, .., t499 = sequence_number * 500 + tx
@@ -732,21 +1511,983 @@ int main(int argc, char** argv) {
       // sequence_number := packet->sequence_number : ranges from 0 to sequence_length
       //
       // [tab][channel_offset][sequence_number][PAYLOADSIZE_STOKESIQUV]
-      memcpy(
-        &buf[(((packet->tab_index * NCHANNELS/4) + curr_channel / 4) * sequence_length + packet->sequence_number) * PAYLOADSIZE_STOKESIQUV],
-        packet->record, PAYLOADSIZE_STOKESIQUV);
-    }
+      //
+      // or when transposed:
+      // [tab][stokes][channel][sequence_number][IQUV_SAMPLES]
+      //
+      // packet slots: [tab][channel_offset][sequence_number]
+      return ((packet->tab_index * NCHANNELS / STOKESIQUV_CHANNELS) + curr_channel / STOKESIQUV_CHANNELS) * STOKESIQUV_SEQUENCE_LENGTH + packet->sequence_number;
+  }
+}
+
+/**
+ * Find the place of the packet payload in the ringbuffer page
+ * Inlined with a constant placement, the layout constants fold into the address computation.
+ *
+ * @param {ringstate_t *} ring Run parameters
+ * @param {int} placement PLACEMENT_* layout of the page
+ * @param {char *} buf Ringbuffer page
+ * @param {int} slot Packet slot
+ * @returns {char *} Destination of the payload
+ */
+static inline __attribute__((always_inline)) char *destination_in_layout(ringstate_t *ring, int placement, char *buf, int slot) {
+  int row = slot / (placement == PLACEMENT_STOKESI || placement == PLACEMENT_STOKESI_REMAPPED ? STOKESI_SEQUENCE_LENGTH : STOKESIQUV_SEQUENCE_LENGTH);
+  size_t channel_stride = STOKESIQUV_SEQUENCE_LENGTH * IQUV_SAMPLES;
+
+  switch (placement) {
+    case PLACEMENT_STOKESI:
+    case PLACEMENT_STOKESI_REMAPPED:
+      // stokes I: channels are padded to padded_size
+      return &buf[row * ring->padded_size + (slot % STOKESI_SEQUENCE_LENGTH) * PAYLOADSIZE_STOKESI];
+
+    case PLACEMENT_STOKESIQUV_TRANSPOSED:
+      // stokes IQUV transposed: the time series of stokes I of the first channel of the packet
+      return &buf[((row / (NCHANNELS / 4)) * 4 * NCHANNELS + (row % (NCHANNELS / 4)) * 4) * channel_stride + (slot % STOKESIQUV_SEQUENCE_LENGTH) * IQUV_SAMPLES];
+
+    default:
+      // stokes IQUV
+      return &buf[slot * PAYLOADSIZE_STOKESIQUV];
+  }
+}
+
+/**
+ * Find the packet slot of a packet, for the placement of the run
+ *
+ * @param {ringstate_t *} ring Run parameters
+ * @param {packet_t *} packet The packet header
+ * @param {unsigned short} curr_channel Channel index of the packet
+ * @returns {int} The packet slot, or -1 if the payload should be dropped
+ */
+int packet_slot(ringstate_t *ring, packet_t *packet, unsigned short curr_channel) {
+  return slot_in_layout(ring->placement, packet, curr_channel);
+}
+
+/**
+ * Find the place of the packet payload in the ringbuffer page, for the placement of the run
+ *
+ * @param {ringstate_t *} ring Run parameters
+ * @param {char *} buf Ringbuffer page
+ * @param {int} slot Packet slot
+ * @returns {char *} Destination of the payload
+ */
+char *packet_destination(ringstate_t *ring, char *buf, int slot) {
+  return destination_in_layout(ring, ring->placement, buf, slot);
+}
+
+/**
+ * Mark a packet slot as arrived in the arrival mask of a page
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {int} page_slot Slot of the page in the window
+ * @param {int} slot Packet slot
+ * @returns {int} 1 for a new packet, 0 for a duplicate
+ */
+static inline int mark_arrived(receiver_t *self, int page_slot, int slot) {
+  unsigned long bit = 1UL << (slot % 64);
 
-    // book keeping
-    packets_in_buffer++;
+  if (atomic_fetch_or_explicit(&self->ring->arrived[page_slot][slot / 64], bit, memory_order_relaxed) & bit) {
+    atomic_fetch_add_explicit(&self->duplicates, 1, memory_order_relaxed);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Add the receive time of a packet to the arrival statistics of its page
+ * Should be called while holding the pages.
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {int} page_slot Slot of the page in the window
+ * @param {unsigned long} timestamp Timestamp of the packet
+ * @param {unsigned long} arrival Receive time of the packet, in ns since the epoch
+ */
+static inline void record_arrival(receiver_t *self, int page_slot, unsigned long timestamp, unsigned long arrival) {
+  arrivals_t *arrivals = &self->arrivals[page_slot];
+  unsigned long sent = timestamp * TIMEUNIT_NS;
+
+  if (arrival >= sent) {
+    hist_add(&arrivals->latency, arrival - sent);
+  } else {
+    hist_add(&arrivals->latency, 0);
+    arrivals->early++;
+  }
+  if (!arrivals->first || arrival < arrivals->first) {
+    arrivals->first = arrival;
+  }
+  if (arrival > arrivals->last) {
+    arrivals->last = arrival;
+  }
+}
+
+/**
+ * Receive a single packet, and scatter its payload directly to its place in the ringbuffer page
+ *
+ * The header is peeked at first to find the destination, then the packet is read with
+ * the header going to the packet buffer, and the record going to the page.
+ * This saves a copy of the payload, at the cost of two system calls per packet.
+ *
+ * @param {receiver_t *} self The receiver
+ */
+void receive_direct(receiver_t *self) {
+  ringstate_t *ring = self->ring;
+  int sockfd = self->capture.sockfd;
+  packet_t *packet = &self->capture.packet_buffer[0];
+  int curr_channel;
+  struct iovec iov[2];
+  struct msghdr msg;
+  char control[CAPTURE_CONTROL];
+  unsigned long arrival;
+  ssize_t nbytes;
+  char *buf;
+  char *dest = NULL;
+  int page_slot;
+  int slot;
+
+  check_timeout(self);
+
+  // peek at the header, MSG_TRUNC gives the length of the datagram; only release the page when we have to wait for the network
+  nbytes = recv(sockfd, packet, APPHEADER, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+  if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    release_hold(self);
+    nbytes = recv(sockfd, packet, APPHEADER, MSG_PEEK | MSG_TRUNC);
+  }
+  if (nbytes == -1) {
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+      // interrupted, or no packets within the receive timeout
+      return;
+    }
+    LOG("ERROR Could not read packets: %s\n", strerror(errno));
+    clean_exit(0);
+  }
+  if (nbytes < APPHEADER + ring->expected_payload) {
+    // a short datagram, like the capture backends drop; only peeked at, so read it to drop it
+    memset(packet, 0, sizeof(packet_t));
+    nbytes = recv(sockfd, packet, sizeof(packet_t), 0);
+    atomic_fetch_add_explicit(&self->packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&self->batches, 1, memory_order_relaxed);
+    if (reject_packet(self, BAD_PAYLOAD)) {
+      LOG("Warning: packet of %li bytes instead of %li\n", (long) nbytes, (long) (APPHEADER + ring->expected_payload));
+    }
+    quarantine_packet(self, packet);
+    abort_on_bad_packets(self);
+    return;
+  }
+
+  // find the destination of the payload
+  curr_channel = check_packet(self, packet);
+  buf = curr_channel < 0 ? NULL : enter_page(self, bswap_64(packet->timestamp), &page_slot);
+  if (buf) {
+    slot = packet_slot(ring, packet, curr_channel);
+    if (slot >= 0 && mark_arrived(self, page_slot, slot)) {
+      dest = packet_destination(ring, buf, slot);
+    }
+  }
+
+  // read the packet, dropped payloads go to the packet buffer
+  iov[0].iov_base = packet;
+  iov[0].iov_len = APPHEADER;
+  iov[1].iov_base = dest ? dest : (char *) packet->record;
+  iov[1].iov_len = ring->expected_payload;
+
+  memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  do {
+    nbytes = recvmsg(sockfd, &msg, 0);
+  } while (nbytes == -1 && errno == EINTR);
+  if (nbytes == -1) {
+    LOG("ERROR Could not read packets: %s\n", strerror(errno));
+    clean_exit(0);
+  }
+  atomic_fetch_add_explicit(&self->packets, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&self->batches, 1, memory_order_relaxed);
+
+  if (curr_channel < 0) {
+    quarantine_packet(self, packet);
+    return;
+  }
+
+  arrival = capture_control(&self->capture, control, msg.msg_controllen);
+  if (dest && arrival) {
+    record_arrival(self, page_slot, bswap_64(packet->timestamp), arrival);
+  }
+}
+
+/**
+ * Receive a new batch of packets when the current batch is done
+ * Returns without packets when the observation has ended and no packets arrive
+ *
+ * @param {receiver_t *} self The receiver
+ */
+void next_batch(receiver_t *self) {
+  capture_t *cap = &self->capture;
+  int npackets;
+
+  while (self->packet_idx >= cap->npackets) {
+    capture_release_batch(cap);
+
+    // do not hold on to the page while waiting for the network
+    release_hold(self);
+
+    // read new packets from the network
+    npackets = capture_next_batch(cap);
+    if (npackets == CAPTURE_END) {
+      // end of the input file: release the open pages as if the end time was reached
+      rotate_page(self, self->ring->endpacket);
+      continue;
+    }
+    if (npackets < 0) {
+      LOG("ERROR Could not read packets\n");
+      clean_exit(0);
+    }
+    if (!atomic_load_explicit(&self->idle, memory_order_relaxed)) {
+      atomic_fetch_add_explicit(&self->packets, cap->npackets + cap->short_packets, memory_order_relaxed);
+      atomic_fetch_add_explicit(&self->batches, 1, memory_order_relaxed);
+      if (cap->short_packets) {
+        reject_short_packets(self);
+      }
+    }
+    cap->short_packets = 0;
+    check_timeout(self);
+    // go to start of the batch
+    self->packet_idx = 0;
+
+    // no packets within the receive timeout, and the observation has ended: let the receiver go back to idle
+    if (npackets == 0 && !atomic_load_explicit(&self->idle, memory_order_relaxed) && !atomic_load_explicit(&self->ring->running, memory_order_relaxed)) {
+      return;
+    }
+  }
+}
+
+/**
+ * Get the next packet from the current batch, receiving a new batch when needed
+ *
+ * @param {receiver_t *} self The receiver
+ * @returns {packet_t *} The packet
+ */
+packet_t *next_packet(receiver_t *self) {
+  next_batch(self);
+  return self->capture.packets[self->packet_idx++];
+}
+
+/**
+ * Receive time of a packet of the current batch
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {int} idx Index of the packet in the batch
+ * @returns {unsigned long} Receive time in ns since the epoch, 0 when unknown
+ */
+static inline unsigned long packet_arrival(receiver_t *self, int idx) {
+  return self->capture.timestamps ? self->capture.arrival[idx] : 0;
+}
+
+/**
+ * Copy a packet with a valid header to the ringbuffer
+ * Inlined with a constant placement into one routine per layout, see place_packet.
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {packet_t *} packet The packet
+ * @param {unsigned long} timestamp Timestamp of the packet
+ * @param {unsigned short} curr_channel Channel index of the packet
+ * @param {unsigned long} arrival Receive time of the packet, in ns since the epoch, 0 when unknown
+ * @param {int} placement PLACEMENT_* layout of the page
+ */
+static inline __attribute__((always_inline)) void place_in_layout(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival, int placement) {
+  ringstate_t *ring = self->ring;
+  char *buf;                        // Page to copy the packet to
+  int page_slot;                    // Slot of the page in the window
+  int slot;                         // Packet slot in the page
+
+  // check timestamps, and get the page for this packet
+  buf = enter_page(self, timestamp, &page_slot);
+  if (!buf) {
+    return;
+  }
+
+  // book keeping
+  slot = slot_in_layout(placement, packet, curr_channel);
+  if (slot < 0 || !mark_arrived(self, page_slot, slot)) {
+    return;
+  }
+  if (arrival) {
+    record_arrival(self, page_slot, timestamp, arrival);
+  }
+
+  // copy to ringbuffer
+  switch (placement) {
+    case PLACEMENT_STOKESI:
+    case PLACEMENT_STOKESI_REMAPPED:
+      stream_copy(destination_in_layout(ring, placement, buf, slot), packet->record, PAYLOADSIZE_STOKESI);
+      break;
+    case PLACEMENT_STOKESIQUV_TRANSPOSED:
+      transpose_iquv(destination_in_layout(ring, placement, buf, slot), packet->record,
+          NCHANNELS * STOKESIQUV_SEQUENCE_LENGTH * IQUV_SAMPLES, STOKESIQUV_SEQUENCE_LENGTH * IQUV_SAMPLES);
+      break;
+    default:
+      stream_copy(destination_in_layout(ring, placement, buf, slot), packet->record, PAYLOADSIZE_STOKESIQUV);
+      break;
+  }
+}
+
+static void place_stokesi(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival) {
+  place_in_layout(self, packet, timestamp, curr_channel, arrival, PLACEMENT_STOKESI);
+}
+
+static void place_stokesi_remapped(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival) {
+  place_in_layout(self, packet, timestamp, curr_channel, arrival, PLACEMENT_STOKESI_REMAPPED);
+}
+
+static void place_stokesiquv(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival) {
+  place_in_layout(self, packet, timestamp, curr_channel, arrival, PLACEMENT_STOKESIQUV);
+}
+
+static void place_stokesiquv_transposed(receiver_t *self, packet_t *packet, unsigned long timestamp, unsigned short curr_channel, unsigned long arrival) {
+  place_in_layout(self, packet, timestamp, curr_channel, arrival, PLACEMENT_STOKESIQUV_TRANSPOSED);
+}
+
+// The placement routine for the layout of the run, selected at startup
+place_t place_packet = place_stokesi;
+
+/**
+ * Select the placement routine for the layout of the run
+ *
+ * @param {int} placement PLACEMENT_* layout of the page
+ */
+void place_packet_init(int placement) {
+  switch (placement) {
+    case PLACEMENT_STOKESI:               place_packet = place_stokesi; break;
+    case PLACEMENT_STOKESI_REMAPPED:      place_packet = place_stokesi_remapped; break;
+    case PLACEMENT_STOKESIQUV:            place_packet = place_stokesiquv; break;
+    case PLACEMENT_STOKESIQUV_TRANSPOSED: place_packet = place_stokesiquv_transposed; break;
+  }
+}
+
+/**
+ * Check a packet, and copy it to the ringbuffer
+ *
+ * @param {receiver_t *} self The receiver
+ * @param {packet_t *} packet The packet
+ * @param {unsigned long} arrival Receive time of the packet, in ns since the epoch, 0 when unknown
+ */
+void process_packet(receiver_t *self, packet_t *packet, unsigned long arrival) {
+  int curr_channel;                 // Current channel index
+
+  // check the header
+  curr_channel = check_packet(self, packet);
+  if (curr_channel < 0) {
+    quarantine_packet(self, packet);
+    return;
+  }
+
+  place_packet(self, packet, bswap_64(packet->timestamp), curr_channel, arrival);
+}
+
+/**
+ * Check the headers of the next packets of the current batch at once, and copy the packets to the ringbuffer
+ *
+ * @param {receiver_t *} self The receiver
+ */
+void process_packets(receiver_t *self) {
+  capture_t *cap = &self->capture;
+  unsigned long timestamps[VALIDATE_BATCH];
+  unsigned short channels[VALIDATE_BATCH];
+  uint64_t valid;
+  int npackets;
+  int i;
+
+  npackets = cap->npackets - self->packet_idx;
+  if (npackets > VALIDATE_BATCH) {
+    npackets = VALIDATE_BATCH;
+  }
+
+  valid = validate_headers(&self->check, &cap->packets[self->packet_idx], npackets, timestamps, channels);
+  for (i = 0; i < npackets; i++) {
+    if (valid & (1UL << i)) {
+      place_packet(self, cap->packets[self->packet_idx + i], timestamps[i], channels[i], packet_arrival(self, self->packet_idx + i));
+    } else {
+      // find out what is wrong with the packet, and drop it
+      process_packet(self, cap->packets[self->packet_idx + i], 0);
+    }
+  }
+  self->packet_idx += npackets;
+}
+
+/**
+ * Drain packets till the start of the observation, but keep track of which compound beams there are
+ * Sets the compound beam index of the receiver to the most common one, so a few stray packets from another beamformer do not set it
+ *
+ * @param {receiver_t *} self The receiver
+ * @returns {packet_t *} The first packet of the observation
+ */
+packet_t *idle(receiver_t *self) {
+  ringstate_t *ring = self->ring;
+
+  packet_t *packet = NULL;          // Pointer to current packet
+  unsigned long curr_packet = 0;    // Current packet number (is number of packets after unix epoch)
+  unsigned long sequence_time = 0;  // Timestamp for current sequnce
+  unsigned long cb_seen[256];       // Number of packets seen per compound beam index
+  int sampling = ring->idle_sample > 1;
+  int cb;
+
+  atomic_store(&self->idle, 1);
+  memset(cb_seen, 0, sizeof(cb_seen));
+
+  // let the kernel drop most packets till shortly before the start
+  if (sampling) {
+    capture_idle(&self->capture, ring->idle_sample);
+  }
+
+  while (curr_packet < atomic_load(&ring->startpacket)) {
+    packet = next_packet(self);
+
+    // keep track of compound beams, ignoring packets of other science modes
+    if (packet->marker_byte != ring->expected_marker_byte || packet->format_version != 1) {
+      continue;
+    }
+    cb_seen[packet->cb_index]++;
+
+    // keep track of timestamps
+    curr_packet = bswap_64(packet->timestamp);
+    if (sampling && curr_packet + IDLE_MARGIN >= atomic_load(&ring->startpacket)) {
+      capture_idle(&self->capture, 1);
+      sampling = 0;
+    }
+
+    if (self->id == 0 && curr_packet != sequence_time) {
+      LOG("Current packet is %li\n", curr_packet);
+      sequence_time = curr_packet;
+    }
+  }
+  atomic_store(&self->idle, 0);
+
+  self->cb_index = packet->cb_index;
+  for (cb = 0; cb < 256; cb++) {
+    if (cb_seen[cb] > cb_seen[self->cb_index]) {
+      self->cb_index = cb;
+    }
+  }
+
+  return packet;
+}
+
+/**
+ * Receive packets from the receiver's capture: idle till the start packet, then copy packets to the ringbuffer
+ * Does not return; the run ends with a clean_exit from rotate_page, in daemon mode the receiver goes back to idle
+ *
+ * @param {void *} arg The receiver_t for this thread
+ */
+void *receiver_run(void *arg) {
+  receiver_t *self = (receiver_t *)arg;
+  ringstate_t *ring = self->ring;
+  packet_t *packet;
+
+  thread_receiver = self;
+
+  // pin the thread to its core
+  if (pin_thread(pthread_self(), self->core) != 0) {
+    LOG("Warning: cannot pin receiver %i to core %i\n", self->id, self->core);
+  }
+
+  while (1) {
+    // ============================================================
+    // idle till start time
+    // ============================================================
+
+    packet = idle(self);
+
+    // ============================================================
+    // run till end time
+    // ============================================================
+
+    // process the first (already-read) packet
+    header_check_init(&self->check, ring->expected_marker_byte, self->cb_index, ring->expected_payload, ring->ntabs, ring->sequence_length);
+    process_packet(self, packet, packet_arrival(self, self->packet_idx - 1));
+
+    if (ring->zerocopy) {
+      // finish the packets left over from the idle loop, then continue without the packet buffer
+      while (self->packet_idx < self->capture.npackets) {
+        process_packet(self, self->capture.packets[self->packet_idx], packet_arrival(self, self->packet_idx));
+        self->packet_idx++;
+      }
+      while (atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+        receive_direct(self);
+      }
+      continue;
+    }
+
+    while (1) {
+      next_batch(self);
+      if (!atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+        // end of the observation; the rest of the batch is drained by the idle loop
+        break;
+      }
+      if (self->check.batched) {
+        process_packets(self);
+      } else {
+        process_packet(self, self->capture.packets[self->packet_idx], packet_arrival(self, self->packet_idx));
+        self->packet_idx++;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Start an observation: get the first ringbuffer page, and let the receivers start at the start packet
+ * The header of the observation should have been written to the ringbuffer, and the receivers should be idle.
+ *
+ * @param {ringstate_t *} ring Shared state
+ * @param {unsigned long} startpacket Packet number to start (in units of TIMEUNIT since unix epoch)
+ * @param {float} duration Run time in seconds
+ */
+void start_observation(ringstate_t *ring, unsigned long startpacket, float duration) {
+  struct timespec now;
+  unsigned long current;
+
+  ring->endpacket = startpacket + lroundf(duration * TIMEUNIT);
+  LOG("Start time (unix time) = %lu\n", startpacket / TIMEUNIT);
+  LOG("End time (unix time) = %lu\n", ring->endpacket / TIMEUNIT);
+  LOG("Duration (s) = %f\n", duration);
+  LOG("Start packet = %lu\n", startpacket);
+  LOG("End packet = %lu\n", ring->endpacket);
+
+  //  get a new buffer
+  ring->initial_buf = ipcbuf_get_next_write ((ipcbuf_t *)ring->hdu->data_block);
+  ring->first = 0;
+  ring->npages = 0;
+  atomic_store(&ring->deadline, 0);
+
+  // end on time when the stream stops before the end; a file is read till its end instead.
+  // When the end time has passed already, the timestamps are not the current time: the first page sets the deadline
+  clock_gettime(CLOCK_REALTIME, &now);
+  current = (now.tv_sec * 1000000000UL + now.tv_nsec) / TIMEUNIT_NS;
+  if (ring->endpacket > current && receivers[0].capture.backend != CAPTURE_FILE) {
+    atomic_store(&ring->end_deadline, end_time_ms(ring, current, now_ms()));
+  } else {
+    atomic_store(&ring->end_deadline, 0);
+  }
+
+  pthread_mutex_lock(&ring->stats_lock);
+  ring->totals.startpacket = startpacket;
+  ring->totals.endpacket = ring->endpacket;
+  pthread_mutex_unlock(&ring->stats_lock);
+
+  // the receivers leave the idle loop once the start packet is set
+  atomic_store(&ring->running, 1);
+  atomic_store(&ring->startpacket, startpacket);
+}
+
+/**
+ * Wait till the current observation has finished, and all receivers are idle
+ *
+ * @param {ringstate_t *} ring Shared state
+ */
+void wait_observation(ringstate_t *ring) {
+  int i;
+
+  while (atomic_load(&ring->running)) {
+    usleep(1000);
+  }
+  for (i = 0; i < nreceivers; i++) {
+    while (!atomic_load(&receivers[i].idle)) {
+      usleep(1000);
+    }
+  }
+}
+
+/**
+ * Publish the run statistics to shared memory every STATS_INTERVAL milliseconds
+ *
+ * @param {void *} arg The ringstate_t
+ */
+void *stats_run(void *arg) {
+  ringstate_t *ring = (ringstate_t *)arg;
+  struct timespec now;
+  stats_t values;
+  int i;
+
+  while (1) {
+    usleep(STATS_INTERVAL * 1000);
+
+    pthread_mutex_lock(&ring->stats_lock);
+    memcpy(&values, &ring->totals, sizeof(stats_t));
+    pthread_mutex_unlock(&ring->stats_lock);
+
+    for (i = 0; i < nreceivers; i++) {
+      values.packets += atomic_load_explicit(&receivers[i].packets, memory_order_relaxed);
+      values.batches += atomic_load_explicit(&receivers[i].batches, memory_order_relaxed);
+    }
+    values.cb_index = receivers[0].cb_index;
+    values.running = atomic_load(&ring->running);
+    clock_gettime(CLOCK_REALTIME, &now);
+    values.updated = now.tv_sec * 1000000000UL + now.tv_nsec;
+
+    stats_publish(ring->stats, &values);
+  }
+
+  return NULL;
+}
+
+/**
+ * Set up a receiver and open its packet capture
+ *
+ * @param {receiver_t *} self The receiver to initialize
+ * @param {ringstate_t *} ring Shared state
+ * @param {int} id Receiver number
+ * @param {int} core Core to pin the receiver to, or -1
+ * @param {int} backend Capture backend
+ * @param {char *} interface Network interface for the capture, or NULL
+ * @param {int} port Network port
+ * @param {int} nreceivers Number of receivers sharing the port
+ */
+void init_receiver(receiver_t *self, ringstate_t *ring, int id, int core, int backend, char *interface, int port, int nreceivers) {
+  int i;
+
+  self->id = id;
+  self->core = core;
+  self->ring = ring;
+  self->cb_index = 255;
+  self->packet_idx = 0;
+  atomic_init(&self->hold, 0);
+  atomic_init(&self->idle, 0);
+  atomic_init(&self->late, 0);
+  atomic_init(&self->duplicates, 0);
+  for (i = 0; i < NBAD; i++) {
+    atomic_init(&self->bad[i], 0);
+  }
+  atomic_init(&self->packets, 0);
+  atomic_init(&self->batches, 0);
+
+  capture_open(&self->capture, backend, interface, port, APPHEADER + ring->expected_payload, id, nreceivers);
+}
+
+int main(int argc, char** argv) {
+  // network state
+  int port;                 // port number
+  int nthreads = 1;         // number of receiver threads
+  int zerocopy = 0;         // receive payloads directly into the ringbuffer
+  int backend = CAPTURE_RECVMMSG; // packet capture backend
+  char *interface = NULL;   // network interface to capture on
+  int window = 1;           // number of open ringbuffer pages
+  int timeout = 100;        // release the oldest open page after this time (ms)
+  int mask_trailer = 0;     // write the arrival mask after the data
+  int fill_value = -1;      // overwrite missing packets with this value, -1 to leave them
+  int copy_kernel = STREAM_COPY_AUTO; // payload copy kernel
+  int transpose = 0;        // transpose Stokes IQUV
+  int cores[CPU_SETSIZE];   // cores for the receivers
+  int ncores = 0;           // number of cores for the receivers, 0 to choose automatically
+  int helper_core = -1;     // core for the other threads, -1 for any
+  int bind_numa = 0;        // bind the ringbuffer to the NUMA node of the network interface
+  int nic_node = -1;        // NUMA node of the network interface
+  int policy = POLICY_DROP; // what to do with packets with a bad header
+  int abort_limit = 0;      // stop when more bad packets arrive in one second
+  char *quarantine = NULL;  // file for packets with a bad header
+  char *control = NULL;     // control fifo for the daemon mode
+  int idle_sample = IDLE_SAMPLE; // while idling, keep one in this many packets
+  char *stats = NULL;       // shared memory name for the run statistics
+  int timestamps = TIMESTAMPS_OFF; // receive timestamps for the arrival latency
+  char *input = NULL;       // pcap file to read instead of the network
+  pthread_t stats_thread;
+  pthread_t signal_thread;
+  sigset_t sigterm;
+  FILE *control_fifo = NULL;
+
+  // ringbuffer state
+  dada_hdu_t *hdu;
+  ringstate_t ring;         // state shared by the receivers
+
+  // run parameters
+  float duration;          // run time in seconds
+  int science_case;        // 3 or 4
+  int science_mode;        // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
+  unsigned long startpacket;           // Packet number to start (in units of TIMEUNIT since unix epoch)
+  int padded_size;
+  int freqissue_workaround = 0; // Do we need to work around the FREQISSUE bug?
+
+  // local vars
+  char *header = NULL;
+  char *key;
+  char *logfile;
+  const char mode = 'w';
+  size_t required_size = 0;
+  int ntabs = 0;
+  int sequence_length; // number of packages belonging to a sequence
+  const science_mode_t *mode_desc;
+  int i;
+
+  // parse commandline
+  if (argc == 1) {
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+  parseOptions(argc, argv, &header, &key, &startpacket, &duration, &port, &logfile, &freqissue_workaround, &nthreads, &zerocopy, &backend, &interface, &window, &timeout, &mask_trailer, &fill_value, &copy_kernel, &transpose, cores, &ncores, &helper_core, &bind_numa, &policy, &abort_limit, &quarantine, &control, &idle_sample, &stats, &timestamps, &input);
+
+  // set up logging
+  if (logfile) {
+    runlog = fopen(logfile, &mode);
+    if (! runlog) {
+      LOG("ERROR opening logfile: %s\n", logfile);
+      exit(EXIT_FAILURE);
+    }
+    LOG("Logging to logfile: %s\n", logfile);
+    free (logfile);
+  }
+  LOG("fill ringbuffer version: " VERSION "\n");
+
+  // daemon mode: without -h, -s, and -d wait for the first observation
+  if (control) {
+    control_fifo = open_control(control);
+    while (!header && next_observation(control_fifo, &header, &startpacket, &duration) < 0) {
+      // skip invalid lines
+    }
+    free(control);
+  }
+
+  // ring buffer
+  LOG("Connecting to ringbuffer\n");
+  hdu = init_ringbuffer(header, key, &required_size, &science_case, &science_mode, &padded_size); // sets required_size to actual size
+
+  free(header); header = NULL;
+  free(key); key = NULL;
+
+  mode_desc = science_mode_lookup(science_case, science_mode);
+  if (!mode_desc) {
+    LOG("ERROR. Science case %i, mode %i not supported\n", science_case, science_mode);
+    exit(EXIT_FAILURE);
+  }
+  LOG("Science case = %i\n", science_case);
+  LOG("Science mode = %i [ %s ]\n", science_mode, mode_desc->name);
+
+  unsigned char expected_marker_byte = mode_desc->marker_byte;
+  unsigned short expected_payload = mode_desc->payload_size;
+  int packets_per_sample = mode_desc->nslots;
+  int placement;
+  ntabs = mode_desc->ntabs;
+  sequence_length = mode_desc->sequence_length;
+  required_size = science_mode_page_size(mode_desc, padded_size);
+
+  if (transpose) {
+    if ((science_mode & 1) == 0) {
+      LOG("ERROR. Transposing needs Stokes IQUV (science mode 1 or 3)\n");
+      exit(EXIT_FAILURE);
+    }
+    LOG("Writing Stokes IQUV as [tab][stokes][channel][time]\n");
+  }
+  if ((science_mode & 1) == 0) {
+    placement = freqissue_workaround ? PLACEMENT_STOKESI_REMAPPED : PLACEMENT_STOKESI;
+  } else {
+    placement = transpose ? PLACEMENT_STOKESIQUV_TRANSPOSED : PLACEMENT_STOKESIQUV;
+  }
+  place_packet_init(placement);
+
+  LOG("Expected marker byte= 0x%X\n", expected_marker_byte);
+  LOG("Expected payload = %i B\n", expected_payload);
+  LOG("Packets per sample = %i\n", packets_per_sample);
+
+  // shared state
+  memset(&ring, 0, sizeof(ringstate_t));
+  ring.hdu = hdu;
+  ring.required_size = required_size;
+  ring.science_mode = science_mode;
+  ring.ntabs = ntabs;
+  ring.sequence_length = sequence_length;
+  ring.padded_size = padded_size;
+  ring.packets_per_sample = packets_per_sample;
+  ring.placement = placement;
+  ring.zerocopy = zerocopy;
+  ring.transpose = transpose;
+  ring.window = window;
+  ring.timeout = timeout;
+  ring.mask_trailer = mask_trailer;
+  ring.fill = fill_value >= 0;
+  ring.fill_value = fill_value;
+  ring.expected_marker_byte = expected_marker_byte;
+  ring.expected_payload = expected_payload;
+  ring.startpacket = NO_OBSERVATION;
+  ring.daemon_mode = control_fifo != NULL;
+  ring.idle_sample = idle_sample;
+  ring.policy = policy;
+  ring.abort_limit = abort_limit;
+
+  if (policy == POLICY_QUARANTINE) {
+    ring.quarantine = fopen(quarantine, "wb");
+    if (!ring.quarantine) {
+      LOG("ERROR opening quarantine file %s: %s\n", quarantine, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    signal_quarantine = ring.quarantine;
+    LOG("Writing packets with a bad header to %s\n", quarantine);
+    free(quarantine);
+  } else if (policy == POLICY_ABORT) {
+    LOG("Stopping on more than %i packets with a bad header per second\n", abort_limit);
+  }
+
+  //  get a new buffer
+  if (interface) {
+    nic_node = nic_numa_node(interface);
+    if (nic_node >= 0) {
+      LOG("Network interface %s is on NUMA node %i\n", interface, nic_node);
+    } else if (bind_numa) {
+      LOG("Warning: NUMA node of network interface %s unknown, not binding the ringbuffer\n", interface);
+      bind_numa = 0;
+    }
+  }
+  prefault_ringbuffer(hdu, nic_node, bind_numa);
+
+  // packet arrival masks, one per open page
+  ring.nslots = mode_desc->nslots;
+  ring.layout.nslots = ring.nslots;
+  ring.layout.sequence_length = sequence_length;
+  ring.layout.payload_size = expected_payload;
+  ring.layout.row_size = science_mode_row_size(mode_desc, padded_size);
+  ring.layout.transposed = transpose;
+  for (i = 0; i < MAX_WINDOW; i++) {
+    ring.arrived[i] = calloc((ring.nslots + 63) / 64, sizeof(unsigned long));
+  }
+  if (mask_trailer) {
+    if (ipcbuf_get_bufsz((ipcbuf_t *)hdu->data_block) < required_size + (ring.nslots + 63) / 64 * sizeof(unsigned long)) {
+      LOG("ERROR. ring buffer data block too small for the arrival mask, should be at least %lu\n", required_size + (ring.nslots + 63) / 64 * sizeof(unsigned long));
+      exit(EXIT_FAILURE);
+    }
+    LOG("Arrival mask of %i packets at offset %lu\n", ring.nslots, required_size);
+  }
+  atomic_init(&ring.deadline, 0);
+  atomic_init(&ring.generation, 1);
+  atomic_init(&ring.rotating, 0);
+  signal_rotating = &ring.rotating;
+
+  // run statistics
+  pthread_mutex_init(&ring.stats_lock, NULL);
+  ring.totals.version = STATS_VERSION;
+  ring.totals.size = sizeof(stats_t);
+  ring.totals.pid = getpid();
+  ring.totals.port = port;
+  ring.totals.nreceivers = nthreads;
+  ring.totals.science_mode = science_mode;
+  ring.totals.ntabs = ntabs;
+  if (stats) {
+    ring.stats = stats_create(stats);
+    if (!ring.stats) {
+      LOG("ERROR creating shared memory %s for the statistics: %s\n", stats, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    LOG("Publishing statistics in shared memory %s\n", stats);
+    free(stats);
+  }
+  start_observation(&ring, startpacket, duration);
+
+  // payload copy kernel
+  int selected_kernel = stream_copy_init(copy_kernel);
+  if (selected_kernel < 0) {
+    LOG("ERROR. Copy kernel %s not supported by this CPU\n", stream_copy_name(copy_kernel));
+    exit(EXIT_FAILURE);
+  }
+  LOG("Payload copy kernel: %s\n", stream_copy_name(selected_kernel));
+
+  if (window > 1) {
+    LOG("Keeping %i ringbuffer pages open, timeout %i ms\n", window, timeout);
+  }
+
+  // sockets, one per receiver; with multiple receivers pin each to its own core,
+  // preferably on the NUMA node of the network interface
+  if (input) {
+    LOG("Reading packets from %s\n", input);
+  } else {
+    LOG("Opening network port %i using %s\n", port, capture_backend_name(backend));
+  }
+  if (ncores == 0 && nthreads > 1) {
+    if (nic_node >= 0) {
+      ncores = node_cores(nic_node, cores, CPU_SETSIZE);
+    }
+    if (ncores == 0) {
+      ncores = allowed_cores(cores, CPU_SETSIZE);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    init_receiver(&receivers[i], &ring, i, ncores ? cores[i % ncores] : -1, backend, input ? input : interface, port, nthreads);
+    signal_sockfd[i] = receivers[i].capture.sockfd;
+    LOG("Receiver %i on core %i\n", i, receivers[i].core);
+  }
+  nreceivers = nthreads;
+  signal_nsockfd = nthreads;
+
+  // receive timestamps, for the arrival latency per page
+  if (timestamps == TIMESTAMPS_HARDWARE && !input && capture_hw_timestamps(interface) != 0) {
+    LOG("Warning: cannot enable hardware timestamps on %s, using software timestamps\n", interface);
+    timestamps = TIMESTAMPS_SOFTWARE;
+  }
+  if (timestamps) {
+    for (i = 0; i < nthreads; i++) {
+      capture_timestamps(&receivers[i].capture, timestamps);
+    }
+    ring.timestamps = receivers[0].capture.timestamps;
+    if (ring.timestamps) {
+      LOG("Logging the arrival latency using %s receive timestamps\n", input ? "recorded" : ring.timestamps == TIMESTAMPS_HARDWARE ? "hardware" : "software");
+    }
+  }
+
+  // handle SIGTERM in a thread of its own, see signal_run;
+  // blocked before starting the other threads, which inherit the signal mask
+  sigemptyset(&sigterm);
+  sigaddset(&sigterm, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigterm, NULL);
+  if (pthread_create(&signal_thread, NULL, signal_run, &sigterm) != 0) {
+    LOG("ERROR: cannot start the signal thread\n");
+    clean_exit(0);
+  }
+
+  // from here on log through the logging thread, so the receivers do not wait for the terminal or log file
+  if (log_start(helper_core) != 0) {
+    LOG("Warning: cannot start the logging thread, logging synchronously\n");
+  }
+
+  // start receiving; the run is ended by a clean_exit from one of the receivers
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&receivers[i].thread, NULL, receiver_run, &receivers[i]) != 0) {
+      LOG("ERROR: cannot start receiver thread %i\n", i);
+      clean_exit(0);
+    }
+  }
+
+  // move the main thread out of the way of the receivers
+  if (pin_thread(pthread_self(), helper_core) != 0) {
+    LOG("Warning: cannot pin the main thread to core %i\n", helper_core);
+  }
+
+  // the statistics thread inherits the core of the main thread
+  if (ring.stats && pthread_create(&stats_thread, NULL, stats_run, &ring) != 0) {
+    LOG("ERROR: cannot start the statistics thread\n");
+    clean_exit(0);
+  }
+
+  // daemon mode: start the next observation when the current one has finished
+  if (control_fifo) {
+    while (1) {
+      if (next_observation(control_fifo, &header, &startpacket, &duration) < 0) {
+        continue;
+      }
+      wait_observation(&ring);
+      if (write_header(hdu, header, science_case, science_mode, padded_size) == 0) {
+        start_observation(&ring, startpacket, duration);
+      }
+      free(header);
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(receivers[i].thread, NULL);
   }
 
   // clean up and exit
+  log_stop();
   fflush(stdout);
   fflush(stderr);
   fflush(runlog);
 
-  close(sockfd);
   fclose(runlog);
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,42 @@
+/**
+ * Definitions shared by the parts of fill_ringbuffer
+ *
+ */
+#ifndef FILL_RINGBUFFER_H
+#define FILL_RINGBUFFER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "log.h"
+#include "packet.h"
+
+#define IDLE_SAMPLE 64            // While idling before the start, keep one in this many packets
+#define IDLE_MARGIN 1600000       // Capture all packets from this many timestamp units (2.048 s) before the start
+
+#define SOCKBUFSIZE 67108864      // Buffer size of socket
+
+#define END_TIMEOUT 1024          // Without a page timeout, end an observation this long (ms) after its end time when the stream stops
+
+// Reasons to reject a packet
+#define BAD_MARKER   0
+#define BAD_VERSION  1
+#define BAD_CB       2
+#define BAD_TAB      3
+#define BAD_CHANNEL  4
+#define BAD_SEQUENCE 5
+#define BAD_PAYLOAD  6
+#define NBAD         7
+
+#define MAX_THREADS 32            // Maximum number of receiver threads
+#define MAX_WINDOW 4              // Maximum number of open ringbuffer pages
+#define STATS_INTERVAL 100        // Publish the run statistics every this many milliseconds
+
+extern FILE *runlog;
+
+// Write to stdout and the runlog, through the logging thread once it runs
+#define LOG(...) log_printf(__VA_ARGS__)
+
+void clean_exit(int signum);
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * Print the run statistics that fill_ringbuffer publishes in shared memory with '-S <name>'
+ *
+ * The statistics are read without disturbing fill_ringbuffer; they can be printed once,
+ * or repeatedly with '-i <interval>', as text or as one JSON object per line with '-j'.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "stats.h"
+
+/**
+ * Print commandline options
+ */
+void printOptions() {
+  printf("usage: fill_stats -n <name> [-i <interval (s)>] [-j]\n");
+  printf("e.g. fill_stats -n /fill_ringbuffer -i 1\n");
+  printf("\n\nPrint the statistics published by 'fill_ringbuffer -S <name>' once, or every '-i <interval>' seconds\n");
+  printf("Print the statistics as JSON, one object per line, with '-j'\n");
+  return;
+}
+
+/**
+ * Parse commandline
+ */
+void parseOptions(int argc, char*argv[], char **name, float *interval, int *json) {
+  int c;
+
+  int setn=0;
+  while((c=getopt(argc,argv,"n:i:j"))!=-1) {
+    switch(c) {
+      // -n shared memory name
+      case('n'):
+        *name = strdup(optarg);
+        setn=1;
+        break;
+
+      // -i interval in seconds
+      case('i'):
+        *interval = atof(optarg);
+        if (*interval <= 0) {
+          fprintf(stderr, "Interval should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -j print JSON
+      case('j'):
+        *json = 1;
+        break;
+
+      default:
+        printOptions();
+        exit(EXIT_SUCCESS);
+    }
+  }
+
+  // All arguments are required
+  if (!setn) {
+    fprintf(stderr, "Shared memory name not set\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Print an array of counters as a JSON list
+ *
+ * @param {const char *} key Name of the list
+ * @param {const unsigned long *} values The counters
+ * @param {int} n Number of counters
+ */
+void print_json_list(const char *key, const unsigned long *values, int n) {
+  int i;
+
+  printf(", \"%s\": [", key);
+  for (i = 0; i < n; i++) {
+    printf("%s%lu", i ? ", " : "", values[i]);
+  }
+  printf("]");
+}
+
+/**
+ * Print the statistics as a single line JSON object
+ *
+ * @param {stats_t *} stats The statistics
+ */
+void print_json(stats_t *stats) {
+  int i;
+
+  printf("{\"pid\": %i, \"port\": %i, \"nreceivers\": %i, \"science_mode\": %i, \"ntabs\": %i, \"cb_index\": %i, \"running\": %s",
+      stats->pid, stats->port, stats->nreceivers, stats->science_mode, stats->ntabs, stats->cb_index, stats->running ? "true" : "false");
+  printf(", \"updated\": %lu, \"startpacket\": %lu, \"endpacket\": %lu, \"timestamp\": %lu",
+      stats->updated, stats->startpacket, stats->endpacket, stats->timestamp);
+  printf(", \"packets\": %lu, \"batches\": %lu, \"pages\": %lu, \"expected\": %lu, \"missing\": %lu, \"late\": %lu, \"duplicates\": %lu, \"kernel_drops\": %lu",
+      stats->packets, stats->batches, stats->pages, stats->expected, stats->missing, stats->late, stats->duplicates, stats->kernel_drops);
+  printf(", \"bad\": {");
+  for (i = 0; i < NBAD; i++) {
+    printf("%s\"%s\": %lu", i ? ", " : "", bad_reasons[i], stats->bad[i]);
+  }
+  printf("}");
+  printf(", \"rotations\": %lu, \"rotation_ns\": %lu, \"rotation_ns_max\": %lu", stats->rotations, stats->rotation_ns, stats->rotation_ns_max);
+  print_json_list("missing_tab", stats->missing_tab, stats->ntabs < STATS_MAX_TABS ? stats->ntabs : STATS_MAX_TABS);
+  print_json_list("missing_channel", stats->missing_channel, NCHANNELS);
+  printf("}\n");
+}
+
+/**
+ * Print the statistics as text; only the channels with missing packets are listed
+ *
+ * @param {stats_t *} stats The statistics
+ */
+void print_text(stats_t *stats) {
+  struct timespec now;
+  unsigned long nbad;
+  int i, n;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  printf("fill_ringbuffer pid %i, port %i, %i receivers, science mode %i, %i tabs, compound beam %i, %s, updated %.1f s ago\n",
+      stats->pid, stats->port, stats->nreceivers, stats->science_mode, stats->ntabs, stats->cb_index,
+      stats->running ? "running" : "idle", (now.tv_sec * 1000000000.0 + now.tv_nsec - stats->updated) * 1e-9);
+  printf("  observation: start %lu, end %lu, last page %lu\n", stats->startpacket, stats->endpacket, stats->timestamp);
+  printf("  packets:     %lu in %lu batches (%.1f per batch), kernel drops: %lu\n",
+      stats->packets, stats->batches, stats->batches ? 1.0 * stats->packets / stats->batches : 0.0, stats->kernel_drops);
+  printf("  pages:       %lu, expected: %lu, missing: %lu (%.3f%%), late: %lu, duplicates: %lu\n",
+      stats->pages, stats->expected, stats->missing, stats->expected ? 100.0 * stats->missing / stats->expected : 0.0,
+      stats->late, stats->duplicates);
+
+  nbad = 0;
+  for (i = 0; i < NBAD; i++) {
+    nbad += stats->bad[i];
+  }
+  printf("  bad:         %lu", nbad);
+  for (i = 0, n = 0; i < NBAD; i++) {
+    if (stats->bad[i]) {
+      printf("%s%s: %lu", n++ ? ", " : " (", bad_reasons[i], stats->bad[i]);
+    }
+  }
+  printf("%s\n", n ? ")" : "");
+
+  printf("  rotations:   %lu, mean %.1f us, max %.1f us\n", stats->rotations,
+      stats->rotations ? 1e-3 * stats->rotation_ns / stats->rotations : 0.0, 1e-3 * stats->rotation_ns_max);
+
+  printf("  missing per tab:");
+  for (i = 0; i < stats->ntabs && i < STATS_MAX_TABS; i++) {
+    printf(" %lu", stats->missing_tab[i]);
+  }
+  printf("\n");
+
+  printf("  missing per channel:");
+  for (i = 0, n = 0; i < NCHANNELS; i++) {
+    if (stats->missing_channel[i]) {
+      printf(" %i:%lu", i, stats->missing_channel[i]);
+      n++;
+    }
+  }
+  printf("%s\n", n ? "" : " none");
+}
+
+int main(int argc, char** argv) {
+  char *name = NULL;
+  float interval = 0;
+  int json = 0;
+  stats_t *shared;
+  stats_t stats;
+
+  // parse commandline
+  if (argc == 1) {
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+  parseOptions(argc, argv, &name, &interval, &json);
+
+  shared = stats_open(name);
+  if (!shared) {
+    fprintf(stderr, "Cannot open shared memory %s: %s\n", name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  while (1) {
+    if (stats_read(shared, &stats) < 0) {
+      fprintf(stderr, "No consistent statistics in %s, is fill_ringbuffer starting?\n", name);
+      exit(EXIT_FAILURE);
+    }
+    if (stats.version != STATS_VERSION || stats.size != sizeof(stats_t)) {
+      fprintf(stderr, "Statistics version %u (%u bytes) in %s, expected version %u (%lu bytes)\n",
+          stats.version, stats.size, name, STATS_VERSION, sizeof(stats_t));
+      exit(EXIT_FAILURE);
+    }
+
+    if (json) {
+      print_json(&stats);
+    } else {
+      print_text(&stats);
+    }
+    fflush(stdout);
+
+    if (interval == 0) {
+      break;
+    }
+    usleep(interval * 1000000);
+  }
+
+  free(name);
+  exit(EXIT_SUCCESS);
+}
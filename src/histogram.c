@@ -0,0 +1,84 @@
+/**
+ * Log-linear histograms, in the style of HdrHistogram
+ *
+ */
+#include <string.h>
+
+#include "histogram.h"
+
+/**
+ * Empty a histogram
+ *
+ * @param {histogram_t *} hist The histogram
+ */
+void hist_reset(histogram_t *hist) {
+  memset(hist, 0, sizeof(histogram_t));
+}
+
+/**
+ * Add the counts of one histogram to another
+ *
+ * @param {histogram_t *} dst The histogram to add to
+ * @param {const histogram_t *} src The histogram to add
+ */
+void hist_merge(histogram_t *dst, const histogram_t *src) {
+  int i;
+
+  if (src->n == 0) {
+    return;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    dst->count[i] += src->count[i];
+  }
+  dst->n += src->n;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+/**
+ * Upper bound of the values in a bucket
+ *
+ * @param {int} bucket The bucket
+ * @returns {unsigned long} The largest value counted in the bucket
+ */
+static unsigned long bucket_limit(int bucket) {
+  int shift;
+
+  if (bucket < HIST_SUB) {
+    return bucket;
+  }
+  shift = (bucket >> HIST_SUB_BITS) - 1;
+  return ((unsigned long) (HIST_SUB + (bucket & (HIST_SUB - 1)) + 1) << shift) - 1;
+}
+
+/**
+ * Value below which the given percentage of the values lies, rounded up to the end of its bucket
+ *
+ * @param {const histogram_t *} hist The histogram
+ * @param {double} percentile Percentage, 0 to 100
+ * @returns {unsigned long} The value, at most the largest value; 0 for an empty histogram
+ */
+unsigned long hist_percentile(const histogram_t *hist, double percentile) {
+  unsigned long rank, seen = 0;
+  unsigned long limit;
+  int i;
+
+  if (hist->n == 0) {
+    return 0;
+  }
+
+  rank = (unsigned long) (percentile / 100.0 * hist->n + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->count[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+
+  limit = bucket_limit(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+  return limit < hist->max ? limit : hist->max;
+}
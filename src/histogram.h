@@ -0,0 +1,53 @@
+/**
+ * Log-linear histograms, in the style of HdrHistogram
+ *
+ * Values below HIST_SUB are counted exactly; above, every power of two is split in HIST_SUB buckets,
+ * so a bucket is at most 1/HIST_SUB (12.5%) of its value wide. Adding a value is a few instructions,
+ * so it can be done for every packet.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)                          // Buckets per power of two
+#define HIST_MAX_BITS 40                                            // Values up to 2^40 (ns: 18 minutes)
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+  unsigned int count[HIST_BUCKETS];
+  unsigned long n;                  // Number of values
+  unsigned long max;                // Largest value
+} histogram_t;
+
+/**
+ * Add a value to a histogram; values beyond the range are counted in the last bucket
+ *
+ * @param {histogram_t *} hist The histogram
+ * @param {unsigned long} value The value
+ */
+static inline void hist_add(histogram_t *hist, unsigned long value) {
+  int bucket, shift;
+
+  if (value < HIST_SUB) {
+    bucket = value;
+  } else {
+    shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+    if (shift + HIST_SUB_BITS >= HIST_MAX_BITS) {
+      bucket = HIST_BUCKETS - 1;
+    } else {
+      bucket = ((shift + 1) << HIST_SUB_BITS) + ((value >> shift) & (HIST_SUB - 1));
+    }
+  }
+
+  hist->count[bucket]++;
+  hist->n++;
+  if (value > hist->max) {
+    hist->max = value;
+  }
+}
+
+void hist_reset(histogram_t *hist);
+void hist_merge(histogram_t *dst, const histogram_t *src);
+unsigned long hist_percentile(const histogram_t *hist, double percentile);
+
+#endif
@@ -0,0 +1,184 @@
+/**
+ * Asynchronous logging for fill_ringbuffer
+ *
+ * The queue is a bounded multi-producer single-consumer ring: every record has a sequence number,
+ * which tells whether the record is free for the producer claiming position 'head', or filled for the
+ * consumer reading position 'tail'. Producers claim a position with a compare-and-swap on 'head',
+ * so they never wait for each other or for the consumer.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "fill_ringbuffer.h"
+#include "affinity.h"
+#include "log.h"
+
+typedef struct {
+  atomic_ulong sequence;             // Position + 1 when filled, position + LOG_QUEUE when free again
+  char text[LOG_RECORD];
+} log_record_t;
+
+static log_record_t queue[LOG_QUEUE];
+static atomic_ulong head;            // Next position to claim by the producers
+static atomic_ulong dropped;         // Number of messages dropped because the queue was full
+static atomic_int started;           // Set while the logging thread is running
+static atomic_int stopping;          // Stop the logging thread when the queue is empty
+static pthread_t logger;
+
+/**
+ * Write a message to stdout and the log file
+ *
+ * @param {const char *} text The message
+ */
+static void log_write(const char *text) {
+  fputs(text, stdout);
+  if (runlog) {
+    fputs(text, runlog);
+  }
+}
+
+/**
+ * Log a message; queued when the logging thread is running, written directly otherwise
+ * Never blocks when queued.
+ *
+ * @param {const char *} format printf format
+ */
+void log_printf(const char *format, ...) {
+  log_record_t *record;
+  unsigned long pos;
+  long diff;
+  va_list args;
+
+  va_start(args, format);
+
+  if (!atomic_load_explicit(&started, memory_order_acquire)) {
+    char text[LOG_RECORD];
+
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    log_write(text);
+    fflush(stdout);
+    return;
+  }
+
+  // claim a free record
+  pos = atomic_load_explicit(&head, memory_order_relaxed);
+  while (1) {
+    record = &queue[pos % LOG_QUEUE];
+    diff = (long) atomic_load_explicit(&record->sequence, memory_order_acquire) - (long) pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // the queue is full
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      va_end(args);
+      return;
+    } else {
+      // another producer claimed it
+      pos = atomic_load_explicit(&head, memory_order_relaxed);
+    }
+  }
+
+  vsnprintf(record->text, LOG_RECORD, format, args);
+  va_end(args);
+
+  // hand it to the logging thread
+  atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
+}
+
+/**
+ * Write the queued messages, till log_stop
+ *
+ * @param {void *} arg Unused
+ */
+static void *log_run(void *arg) {
+  log_record_t *record;
+  unsigned long tail = 0;             // Next position to write
+  unsigned long reported = 0;         // Number of dropped messages reported so far
+  unsigned long ndropped;
+  char text[LOG_RECORD];
+  int written;
+
+  while (1) {
+    written = 0;
+
+    record = &queue[tail % LOG_QUEUE];
+    while (atomic_load_explicit(&record->sequence, memory_order_acquire) == tail + 1) {
+      log_write(record->text);
+
+      // free the record for the producers of the next round
+      atomic_store_explicit(&record->sequence, tail + LOG_QUEUE, memory_order_release);
+      tail++;
+      record = &queue[tail % LOG_QUEUE];
+      written = 1;
+    }
+
+    ndropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (ndropped != reported) {
+      snprintf(text, sizeof(text), "Warning: the log queue was full, %lu messages dropped\n", ndropped - reported);
+      log_write(text);
+      reported = ndropped;
+      written = 1;
+    }
+
+    if (written) {
+      fflush(stdout);
+      if (runlog) {
+        fflush(runlog);
+      }
+    } else if (atomic_load(&stopping)) {
+      break;
+    } else {
+      usleep(LOG_POLL);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Start the logging thread; from now on messages are queued
+ *
+ * @param {int} core Core to pin the logging thread to, or -1
+ * @returns {int} 0 on success, -1 when the thread could not be started
+ */
+int log_start(int core) {
+  unsigned long i;
+
+  for (i = 0; i < LOG_QUEUE; i++) {
+    atomic_init(&queue[i].sequence, i);
+  }
+  atomic_init(&head, 0);
+  atomic_init(&dropped, 0);
+  atomic_init(&stopping, 0);
+
+  if (pthread_create(&logger, NULL, log_run, NULL) != 0) {
+    return -1;
+  }
+  atomic_store_explicit(&started, 1, memory_order_release);
+
+  if (pin_thread(logger, core) != 0) {
+    LOG("Warning: cannot pin the logging thread to core %i\n", core);
+  }
+  return 0;
+}
+
+/**
+ * Write the queued messages and stop the logging thread; later messages are written directly
+ * Safe to call more than once, or when the thread was not started.
+ */
+void log_stop() {
+  if (!atomic_exchange(&started, 0)) {
+    return;
+  }
+  atomic_store(&stopping, 1);
+  pthread_join(logger, NULL);
+}
@@ -0,0 +1,20 @@
+/**
+ * Asynchronous logging for fill_ringbuffer
+ *
+ * Messages are formatted by the calling thread into fixed-size records in a bounded lock-free queue,
+ * and written to stdout and the log file by a background thread, so the receivers never block on the
+ * terminal or a slow (network) file system. When the queue is full the message is dropped and counted.
+ * Before log_start and after log_stop messages are written directly.
+ */
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_QUEUE   1024          // Number of records in the queue, a power of two
+#define LOG_RECORD  512           // Size of a record, longer messages are truncated
+#define LOG_POLL    1000          // Time between checks of an empty queue, in microseconds
+
+void log_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+int log_start(int core);
+void log_stop();
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * The science cases and modes of the beamformer streams
+ *
+ * Based on the ARTS Interface Specification from BF to SC3+4, ASTRON_SP_066, revision 2.0.
+ */
+#include <stddef.h>
+
+#include "modes.h"
+
+#define STOKESI(science_case, science_mode, name, marker_byte, ntabs) \
+  {science_case, science_mode, name, marker_byte, ntabs, STOKESI_SEQUENCE_LENGTH, PAYLOADSIZE_STOKESI, STOKESI_CHANNELS, \
+    NCHANNELS / STOKESI_CHANNELS, ntabs * NCHANNELS / STOKESI_CHANNELS * STOKESI_SEQUENCE_LENGTH, 0}
+
+#define STOKESIQUV(science_case, science_mode, name, marker_byte, ntabs) \
+  {science_case, science_mode, name, marker_byte, ntabs, STOKESIQUV_SEQUENCE_LENGTH, PAYLOADSIZE_STOKESIQUV, STOKESIQUV_CHANNELS, \
+    NCHANNELS / STOKESIQUV_CHANNELS, ntabs * NCHANNELS / STOKESIQUV_CHANNELS * STOKESIQUV_SEQUENCE_LENGTH, STOKESIQUV_ROW_SIZE}
+
+static const science_mode_t modes[] = {
+  STOKESI   (3, 0, "I+TAB",    0xD0, 9),
+  STOKESIQUV(3, 1, "IQUV+TAB", 0xD1, 9),
+  STOKESI   (3, 2, "I+IAB",    0xD2, 1),
+  STOKESIQUV(3, 3, "IQUV+IAB", 0xD3, 1),
+  STOKESI   (4, 0, "I+TAB",    0xE0, 12),
+  STOKESIQUV(4, 1, "IQUV+TAB", 0xE1, 12),
+  STOKESI   (4, 2, "I+IAB",    0xE2, 1),
+  STOKESIQUV(4, 3, "IQUV+IAB", 0xE3, 1),
+};
+
+/**
+ * Find a science case and mode
+ *
+ * @param {int} science_case 3 or 4
+ * @param {int} science_mode 0 to 3
+ * @returns {const science_mode_t *} The mode, or NULL when it does not exist
+ */
+const science_mode_t *science_mode_lookup(int science_case, int science_mode) {
+  int i;
+
+  for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    if (modes[i].science_case == science_case && modes[i].science_mode == science_mode) {
+      return &modes[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Bytes between the rows of payloads of a ringbuffer page
+ *
+ * @param {const science_mode_t *} mode The science mode
+ * @param {int} padded_size Padded size of a Stokes I channel, from the ringbuffer header
+ * @returns {size_t} The row size
+ */
+size_t science_mode_row_size(const science_mode_t *mode, int padded_size) {
+  return mode->row_size ? mode->row_size : padded_size;
+}
+
+/**
+ * Size of the data of a ringbuffer page
+ *
+ * @param {const science_mode_t *} mode The science mode
+ * @param {int} padded_size Padded size of a Stokes I channel, from the ringbuffer header
+ * @returns {size_t} The page size
+ */
+size_t science_mode_page_size(const science_mode_t *mode, int padded_size) {
+  return (size_t) mode->ntabs * mode->rows_per_tab * science_mode_row_size(mode, padded_size);
+}
@@ -0,0 +1,46 @@
+/**
+ * The science cases and modes of the beamformer streams, shared by the receiver and the generators
+ *
+ * A mode sets the marker byte of the packets, the number of tabs, the number of packets
+ * per channel (or group of 4 channels) and timestamp, the payload size, and the layout of a ringbuffer page:
+ *  - Stokes I:    [tab][channel][padded_size], a row of sequence_length payloads per channel,
+ *                 padded to the padded size of the ringbuffer header
+ *  - Stokes IQUV: [tab][channel / 4][sequence_length][payload]
+ *
+ * The layout constants of the two formats are compile-time constants, so the placement code
+ * specialized per format can fold them.
+ */
+#ifndef MODES_H
+#define MODES_H
+
+#include <stddef.h>
+
+#include "packet.h"
+
+#define STOKESI_SEQUENCE_LENGTH     2    // Packets per channel and timestamp
+#define STOKESI_CHANNELS            1    // Channels per packet
+#define STOKESI_ROW_SIZE            (STOKESI_SEQUENCE_LENGTH * PAYLOADSIZE_STOKESI)  // Bytes per channel without padding
+
+#define STOKESIQUV_SEQUENCE_LENGTH  25   // Packets per group of channels and timestamp
+#define STOKESIQUV_CHANNELS         4    // Channels per packet
+#define STOKESIQUV_ROW_SIZE         (STOKESIQUV_SEQUENCE_LENGTH * PAYLOADSIZE_STOKESIQUV)
+
+typedef struct {
+  int science_case;                  // 3 or 4
+  int science_mode;                  // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
+  const char *name;
+  unsigned char marker_byte;         // See table 3 of the interface specification
+  int ntabs;
+  int sequence_length;               // Number of packets per channel and timestamp
+  int payload_size;                  // Stokes I: 6250, IQUV: 8000
+  int channels_per_packet;           // Stokes I: 1, IQUV: 4
+  int rows_per_tab;                  // Number of rows of sequence_length payloads per tab in a page
+  int nslots;                        // Number of packets per timestamp, the packet slots of a page
+  size_t row_size;                   // Bytes between the rows of a page; 0 for the padded size
+} science_mode_t;
+
+const science_mode_t *science_mode_lookup(int science_case, int science_mode);
+size_t science_mode_row_size(const science_mode_t *mode, int padded_size);
+size_t science_mode_page_size(const science_mode_t *mode, int padded_size);
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * The packets of the beamformer streams, shared by the receiver and the generator
+ *
+ * Header description based on:
+ * ARTS Interface Specification from BF to SC3+4
+ * ASTRON_SP_066_InterfaceSpecificationSC34.pdf
+ * revision 2.0
+ */
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stddef.h>
+
+#define PACKHEADER 114                   // Size of the packet header = PACKETSIZE-PAYLOADSIZE in bytes
+
+#define PACKETSIZE_STOKESI  6364         // Size of the packet, including the header in bytes
+#define PAYLOADSIZE_STOKESI 6250         // Size of the record = packet - header in bytes
+
+#define PACKETSIZE_STOKESIQUV  8114      // Size of the packet, including the header in bytes
+#define PAYLOADSIZE_STOKESIQUV 8000      // Size of the record = packet - header in bytes
+#define PAYLOADSIZE_MAX        8000      // Maximum of payload size of I, IQUV
+
+#define TIMEUNIT 781250           // Conversion factor of timestamp from seconds to (1.28 us) packets
+#define TIMEUNIT_NS 1280          // Length of a timestamp unit in ns
+
+/* We currently use
+ *  - one compound beam per instance
+ *  - one instance of fill_ringbuffer connected to
+ *  - one HDU
+ *
+ * Send on to ringbuffer a single second of data as a three dimensional array:
+ * [tab_index][channel][record] of sizes [0..11][0..1535][0..paddedsize-1] = 18432 * paddedsize for a ringbuffer page
+ *
+ * SC3: records per 1.024s 12500; 9 TABs
+ * SC4: records per 1.024s 12500; 12 TABs
+ */
+
+#define NCHANNELS 1536
+#define PACKETRATESC3 12500 // SC3: records per 1.024s
+#define PACKETRATESC4 12500 // SC4: records per 1.024s
+#define FRAME_TIMESTAMPS 800000 // Timestamp units per frame of 12500 records, 1.024 s
+
+#define MMSG_VLEN  256            // Packets per batch of recvmmsg() or sendmmsg()
+
+typedef struct {
+  unsigned char marker_byte;         // See table 3 in PDF, page 6
+  unsigned char format_version;      // Version: 1
+  unsigned char cb_index;            // [0,39] one compound beam per fill_ringbuffer instance:: ignore
+  unsigned char tab_index;           // [0,ntabs-1] all tabs per fill_ringbuffer instance
+  unsigned short channel_index;      // [0,1535] all channels per fill_ringbuffer instance
+  unsigned short payload_size;       // Stokes I: 6250, IQUV: 8000
+  unsigned long timestamp;           // units of 1.28 us, since 1970-01-01 00:00.000 
+  unsigned char sequence_number;     // SC3: Stokes I: 0-1, Stokes IQUV: 0-24
+                                     // SC4: Stokes I: 0-1, Stokes IQUV: 0-24
+  unsigned char reserved[7];
+  unsigned long flags[3];
+  unsigned char record[PAYLOADSIZE_MAX];
+} packet_t;
+
+// Size of the application header, ie. the UDP payload before the record;
+// PACKHEADER also counts the ethernet, IP and UDP overhead
+#define APPHEADER offsetof(packet_t, record)
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * Verifiable payload patterns for generated packets
+ *
+ * The words are generated two at a time with SSE2, which every x86-64 CPU has,
+ * so filling the payloads does not limit the rate of the generator.
+ */
+#include <string.h>
+#include <emmintrin.h>
+
+#include "pattern.h"
+
+/**
+ * Key of the pattern of a packet (splitmix64 of the packet coordinates)
+ *
+ * @param {unsigned char} tab Tab index
+ * @param {unsigned short} channel Channel index
+ * @param {unsigned char} sequence Sequence number
+ * @param {unsigned long} timestamp Timestamp
+ * @returns {uint64_t} The key
+ */
+uint64_t pattern_key(unsigned char tab, unsigned short channel, unsigned char sequence, unsigned long timestamp) {
+  uint64_t x = timestamp * PATTERN_STEP ^ ((uint64_t) tab << 48 | (uint64_t) channel << 16 | sequence);
+
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * Write the pattern of a key
+ *
+ * @param {unsigned char *} dest Start of the payload
+ * @param {size_t} len Length of the payload in bytes; the last word is cut off when len is not a multiple of 8
+ * @param {uint64_t} key Key of the pattern
+ */
+void pattern_fill(unsigned char *dest, size_t len, uint64_t key) {
+  __m128i words = _mm_set_epi64x(key + PATTERN_STEP, key);
+  __m128i step = _mm_set1_epi64x(2 * PATTERN_STEP);
+  uint64_t tail[2];
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    _mm_storeu_si128((__m128i *)(dest + i +  0), words);
+    words = _mm_add_epi64(words, step);
+    _mm_storeu_si128((__m128i *)(dest + i + 16), words);
+    words = _mm_add_epi64(words, step);
+    _mm_storeu_si128((__m128i *)(dest + i + 32), words);
+    words = _mm_add_epi64(words, step);
+    _mm_storeu_si128((__m128i *)(dest + i + 48), words);
+    words = _mm_add_epi64(words, step);
+  }
+  for (; i + 16 <= len; i += 16) {
+    _mm_storeu_si128((__m128i *)(dest + i), words);
+    words = _mm_add_epi64(words, step);
+  }
+
+  // tail
+  _mm_storeu_si128((__m128i *) tail, words);
+  memcpy(dest + i, tail, len - i);
+}
@@ -0,0 +1,20 @@
+/**
+ * Verifiable payload patterns for generated packets
+ *
+ * The payload of a packet is a sequence of 64-bit words derived from a key, a hash of the tab, channel,
+ * sequence number and timestamp of the packet: word i is key + i * PATTERN_STEP, in host byte order.
+ * Every payload in a page is different, and every word of a payload depends on its position,
+ * so a lost, misplaced or partly written payload is detected by comparing it with the pattern.
+ */
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PATTERN_STEP 0x9E3779B97F4A7C15UL
+
+uint64_t pattern_key(unsigned char tab, unsigned short channel, unsigned char sequence, unsigned long timestamp);
+void pattern_fill(unsigned char *dest, size_t len, uint64_t key);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Reading pcap files, for replaying the beamformer packet streams
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <byteswap.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <net/ethernet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap.h"
+
+/**
+ * Memory map a pcap file for sequential reading, and check its header
+ *
+ * @param {const char *} filename The pcap file
+ * @param {size_t *} size Set to the size of the file
+ * @param {unsigned long *} frac_ns Set to the length of a unit of ts_frac in ns
+ * @param {const char **} error Set to the reason on error
+ * @returns {const unsigned char *} The mapped file, starting with its pcap_header_t, or NULL on error
+ */
+const unsigned char *pcap_map(const char *filename, size_t *size, unsigned long *frac_ns, const char **error) {
+  const pcap_header_t *header;
+  unsigned char *map;
+  struct stat st;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    *error = "cannot open the file";
+    return NULL;
+  }
+  if (st.st_size < sizeof(pcap_header_t)) {
+    close(fd);
+    *error = "not a pcap file";
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *error = "cannot map the file";
+    return NULL;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  *size = st.st_size;
+
+  header = (const pcap_header_t *) map;
+  if (header->magic == PCAP_MAGIC_US) {
+    *frac_ns = 1000;
+  } else if (header->magic == PCAP_MAGIC_NS) {
+    *frac_ns = 1;
+  } else {
+    if (header->magic == bswap_32(PCAP_MAGIC_US) || header->magic == bswap_32(PCAP_MAGIC_NS)) {
+      *error = "written on a host with a different byte order, which is not supported";
+    } else {
+      *error = "not a pcap file";
+    }
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  if (header->linktype != LINKTYPE_ETHERNET && header->linktype != LINKTYPE_RAW && header->linktype != LINKTYPE_IPV4) {
+    *error = "unsupported link type";
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  return map;
+}
+
+/**
+ * Find the UDP payload of a captured IPv4 packet
+ *
+ * @param {const unsigned char *} data The captured bytes
+ * @param {size_t} len Number of captured bytes
+ * @param {unsigned int} linktype Link type of the pcap file
+ * @param {size_t *} payload_len Set to the size of the payload, limited to the captured bytes
+ * @returns {const unsigned char *} The payload, or NULL when this is not an unfragmented IPv4 UDP packet
+ */
+const unsigned char *pcap_udp_payload(const unsigned char *data, size_t len, unsigned int linktype, size_t *payload_len) {
+  const struct iphdr *ip;
+  const struct udphdr *udp;
+  size_t offset = 0;
+  unsigned short ethertype;
+
+  if (linktype == LINKTYPE_ETHERNET) {
+    if (len < ETH_HLEN) {
+      return NULL;
+    }
+    ethertype = data[12] << 8 | data[13];
+    offset = ETH_HLEN;
+    if (ethertype == ETHERTYPE_VLAN && len >= ETH_HLEN + 4) {
+      ethertype = data[16] << 8 | data[17];
+      offset += 4;
+    }
+    if (ethertype != ETHERTYPE_IP) {
+      return NULL;
+    }
+  }
+
+  if (len < offset + sizeof(struct iphdr)) {
+    return NULL;
+  }
+  ip = (const struct iphdr *) &data[offset];
+  if (ip->version != 4 || ip->protocol != IPPROTO_UDP || (ntohs(ip->frag_off) & (IP_MF | IP_OFFMASK))) {
+    return NULL;
+  }
+  offset += ip->ihl * 4;
+
+  if (len < offset + sizeof(struct udphdr)) {
+    return NULL;
+  }
+  udp = (const struct udphdr *) &data[offset];
+  offset += sizeof(struct udphdr);
+
+  *payload_len = ntohs(udp->len) - sizeof(struct udphdr);
+  if (*payload_len > len - offset) {
+    *payload_len = len - offset;
+  }
+  return &data[offset];
+}
@@ -0,0 +1,41 @@
+/**
+ * Minimal pcap file format, for recording and replaying the beamformer packet streams
+ *
+ * A file is a pcap_header_t followed by records, each a pcap_record_t and the captured bytes.
+ * See https://www.tcpdump.org/manpages/pcap-savefile.5.html; the files can be read by tcpdump and wireshark.
+ */
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAP_MAGIC_US 0xa1b2c3d4         // Timestamps in seconds and microseconds
+#define PCAP_MAGIC_NS 0xa1b23c4d         // Timestamps in seconds and nanoseconds
+#define PCAP_SNAPLEN  65535              // Maximum number of bytes captured per packet
+
+#define LINKTYPE_ETHERNET 1              // Ethernet frames, as written by tcpdump
+#define LINKTYPE_RAW      101            // IPv4 or IPv6 packets, as written by record
+#define LINKTYPE_IPV4     228            // IPv4 packets
+
+typedef struct {
+  uint32_t magic;                        // PCAP_MAGIC_US or PCAP_MAGIC_NS, in the byte order of the writer
+  uint16_t version_major;                // 2
+  uint16_t version_minor;                // 4
+  int32_t thiszone;                      // 0
+  uint32_t sigfigs;                      // 0
+  uint32_t snaplen;                      // Maximum number of bytes captured per packet
+  uint32_t linktype;                     // LINKTYPE_*
+} pcap_header_t;
+
+typedef struct {
+  uint32_t ts_sec;                       // Arrival time, seconds since the epoch
+  uint32_t ts_frac;                      // Arrival time, microseconds or nanoseconds
+  uint32_t incl_len;                     // Number of bytes in the file
+  uint32_t orig_len;                     // Length of the packet on the wire
+} pcap_record_t;
+
+const unsigned char *pcap_map(const char *filename, size_t *size, unsigned long *frac_ns, const char **error);
+const unsigned char *pcap_udp_payload(const unsigned char *data, size_t len, unsigned int linktype, size_t *payload_len);
+
+#endif
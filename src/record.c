@@ -0,0 +1,413 @@
+/**
+ * Record the packets arriving on a network port to a pcap file, with their arrival times
+ * Used to reproduce production loss patterns and bad-header incidents offline; replay them with 'send -r <file>'.
+ *
+ * Packets are received with the capture backends of fill_ringbuffer, so the recording shows what fill_ringbuffer sees.
+ * They are appended to large buffers, which a writer thread writes to the file sequentially,
+ * so the receive loop does not wait for the disk.
+ */
+// needed for GNU extension to recvfrom: recvmmsg, bswap
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include "fill_ringbuffer.h"
+#include "capture.h"
+#include "pcap.h"
+
+#define RECORD_BUFFER   (1 << 24)     // Size of a write buffer in bytes
+#define RECORD_NBUFFERS 8             // Number of write buffers
+
+FILE *runlog = NULL;
+
+typedef struct {
+  char *data[RECORD_NBUFFERS];        // The write buffers
+  size_t used[RECORD_NBUFFERS];       // Number of bytes used per buffer
+  unsigned long filled;               // Number of buffers handed to the writer thread
+  unsigned long written;              // Number of buffers written to the file
+  int stopping;                       // Stop the writer thread when all buffers are written
+  int fd;                             // Output file
+  int error;                          // errno of a failed write, or 0
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} writer_t;
+
+static volatile sig_atomic_t stop = 0;
+
+/**
+ * Stop recording after the current batch
+ *
+ * @param {int} signum Signal number
+ */
+static void stop_recording(int signum) {
+  stop = 1;
+}
+
+/**
+ * Print commandline options
+ */
+void printOptions() {
+  printf("usage: record -p <port> -m <science mode> -o <file> [-d <duration (s)>] [-n <packets>] [-b <backend>] [-i <interface>] [-L <timestamps>]\n");
+  printf("e.g. record -p 5000 -m 0 -o cb01.pcap -d 10\n");
+  printf("\n\nRecord the packets on the port to a pcap file, with their arrival times, till the duration or number of packets is reached, or till interrupted\n");
+  printf("The science mode sets the packet size, packets are captured like fill_ringbuffer does with the 'recvmmsg' (default), 'tpacket' or 'uring' backend\n");
+  printf("Use 'software' (default) or 'hardware' receive timestamps with '-L'; hardware timestamps need '-i'\n");
+  printf("Replay the file with 'send -r <file>'\n");
+  return;
+}
+
+/**
+ * Parse commandline
+ */
+void parseOptions(int argc, char*argv[], int *port, int *science_mode, char **output, float *duration, unsigned long *npackets, int *backend, char **interface, int *timestamps) {
+  int c;
+
+  int setp=0, setm=0, seto=0;
+  while((c=getopt(argc,argv,"p:m:o:d:n:b:i:L:"))!=-1) {
+    switch(c) {
+      // -p port number
+      case('p'):
+        *port = atoi(optarg);
+        setp=1;
+        break;
+
+      // -m science mode, for the packet size
+      case('m'):
+        *science_mode = atoi(optarg);
+        if (*science_mode < 0 || *science_mode > 3) {
+          fprintf(stderr, "Illegal science mode '%i'\n", *science_mode);
+          exit(EXIT_FAILURE);
+        }
+        setm=1;
+        break;
+
+      // -o output file
+      case('o'):
+        *output = strdup(optarg);
+        seto=1;
+        break;
+
+      // -d duration in seconds
+      case('d'):
+        *duration = atof(optarg);
+        break;
+
+      // -n number of packets
+      case('n'):
+        *npackets = atol(optarg);
+        break;
+
+      // -b capture backend
+      case('b'):
+        *backend = capture_backend(optarg);
+        if (*backend < 0 || *backend == CAPTURE_FILE) {
+          fprintf(stderr, "Unknown capture backend '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -i network interface
+      case('i'):
+        *interface = strdup(optarg);
+        break;
+
+      // -L receive timestamps
+      case('L'):
+        if (strcmp(optarg, "software") == 0) {
+          *timestamps = TIMESTAMPS_SOFTWARE;
+        } else if (strcmp(optarg, "hardware") == 0) {
+          *timestamps = TIMESTAMPS_HARDWARE;
+        } else {
+          fprintf(stderr, "Unknown receive timestamps '%s'\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      default:
+        printOptions();
+        exit(EXIT_SUCCESS);
+    }
+  }
+
+  // All arguments are required
+  if (!setp || !setm || !seto) {
+    fprintf(stderr, "Port, science mode, and output file are required\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((*backend == CAPTURE_TPACKET || *timestamps == TIMESTAMPS_HARDWARE) && !*interface) {
+    fprintf(stderr, "The tpacket backend and hardware timestamps need a network interface\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Write the filled buffers to the file, till all are written after stopping
+ *
+ * @param {void *} arg The writer
+ */
+static void *writer_run(void *arg) {
+  writer_t *w = arg;
+  char *data;
+  size_t todo;
+  ssize_t n;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (w->written == w->filled && !w->stopping) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if (w->written == w->filled) {
+      break;
+    }
+    data = w->data[w->written % RECORD_NBUFFERS];
+    todo = w->used[w->written % RECORD_NBUFFERS];
+    pthread_mutex_unlock(&w->lock);
+
+    while (todo > 0 && !w->error) {
+      n = write(w->fd, data, todo);
+      if (n < 0) {
+        if (errno != EINTR) {
+          w->error = errno;
+        }
+        continue;
+      }
+      data += n;
+      todo -= n;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->written++;
+    pthread_cond_signal(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+/**
+ * Hand the current buffer to the writer thread, and wait for a free buffer to continue with
+ *
+ * @param {writer_t *} w The writer
+ */
+static void writer_flush(writer_t *w) {
+  pthread_mutex_lock(&w->lock);
+  w->filled++;
+  pthread_cond_signal(&w->cond);
+  while (w->filled - w->written >= RECORD_NBUFFERS) {
+    pthread_cond_wait(&w->cond, &w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  w->used[w->filled % RECORD_NBUFFERS] = 0;
+}
+
+/**
+ * Append bytes to the current buffer
+ *
+ * @param {writer_t *} w The writer
+ * @param {const void *} bytes The bytes
+ * @param {size_t} len Number of bytes, at most RECORD_BUFFER
+ */
+static void writer_append(writer_t *w, const void *bytes, size_t len) {
+  int current = w->filled % RECORD_NBUFFERS;
+
+  if (w->used[current] + len > RECORD_BUFFER) {
+    writer_flush(w);
+    current = w->filled % RECORD_NBUFFERS;
+  }
+  memcpy(&w->data[current][w->used[current]], bytes, len);
+  w->used[current] += len;
+}
+
+/**
+ * Append a packet, with a pcap record header and IPv4 and UDP headers
+ * The addresses are not known for all backends, and are set to 0.0.0.0.
+ *
+ * @param {writer_t *} w The writer
+ * @param {const packet_t *} packet The UDP payload
+ * @param {size_t} len Size of the UDP payload
+ * @param {int} port The UDP port
+ * @param {unsigned long} arrival Arrival time in ns since the epoch
+ */
+static void writer_packet(writer_t *w, const packet_t *packet, size_t len, int port, unsigned long arrival) {
+  struct {
+    pcap_record_t record;
+    struct iphdr ip;
+    struct udphdr udp;
+  } header;                           // no padding: 16, 20 and 8 bytes
+  unsigned char *bytes;
+  unsigned int sum = 0;
+  int i;
+
+  memset(&header, 0, sizeof(header));
+  header.record.ts_sec = arrival / 1000000000UL;
+  header.record.ts_frac = arrival % 1000000000UL;
+  header.record.incl_len = sizeof(struct iphdr) + sizeof(struct udphdr) + len;
+  header.record.orig_len = header.record.incl_len;
+
+  header.ip.version = 4;
+  header.ip.ihl = sizeof(struct iphdr) / 4;
+  header.ip.tot_len = htons(header.record.incl_len);
+  header.ip.frag_off = htons(IP_DF);
+  header.ip.ttl = 64;
+  header.ip.protocol = IPPROTO_UDP;
+  bytes = (unsigned char *) &header.ip;
+  for (i = 0; i < sizeof(struct iphdr); i += 2) {
+    sum += bytes[i] << 8 | bytes[i + 1];
+  }
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  header.ip.check = htons(~sum & 0xffff);
+
+  header.udp.source = htons(port);
+  header.udp.dest = htons(port);
+  header.udp.len = htons(sizeof(struct udphdr) + len);
+  header.udp.check = 0; // no checksum
+
+  writer_append(w, &header, sizeof(header));
+  writer_append(w, packet, len);
+}
+
+int main(int argc, char** argv) {
+  int port;
+  int science_mode;
+  char *output = NULL;
+  float duration = 0;                  // 0: no limit
+  unsigned long maxpackets = 0;        // 0: no limit
+  int backend = CAPTURE_RECVMMSG;
+  char *interface = NULL;
+  int timestamps = TIMESTAMPS_SOFTWARE;
+
+  capture_t cap;
+  writer_t w;
+  pthread_t writer;
+  pcap_header_t header;
+  struct sigaction action;
+  struct timespec start, now;
+  size_t packet_size;
+  unsigned long arrival;
+  unsigned long npackets = 0;
+  double elapsed;
+  int i;
+
+  // parse commandline
+  if (argc == 1) {
+    printOptions();
+    exit(EXIT_FAILURE);
+  }
+  parseOptions(argc, argv, &port, &science_mode, &output, &duration, &maxpackets, &backend, &interface, &timestamps);
+
+  packet_size = APPHEADER + (science_mode == 0 || science_mode == 2 ? PAYLOADSIZE_STOKESI : PAYLOADSIZE_STOKESIQUV);
+
+  // output file and writer thread
+  memset(&w, 0, sizeof(w));
+  w.fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w.fd == -1) {
+    LOG("ERROR: cannot open %s: %s\n", output, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < RECORD_NBUFFERS; i++) {
+    w.data[i] = malloc(RECORD_BUFFER);
+    if (!w.data[i]) {
+      LOG("ERROR: cannot allocate write buffers\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_mutex_init(&w.lock, NULL);
+  pthread_cond_init(&w.cond, NULL);
+  if (pthread_create(&writer, NULL, writer_run, &w) != 0) {
+    LOG("ERROR: cannot start the writer thread\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = PCAP_MAGIC_NS;
+  header.version_major = 2;
+  header.version_minor = 4;
+  header.snaplen = PCAP_SNAPLEN;
+  header.linktype = LINKTYPE_RAW;
+  writer_append(&w, &header, sizeof(header));
+
+  // capture
+  capture_open(&cap, backend, interface, port, packet_size, 0, 1);
+  if (timestamps == TIMESTAMPS_HARDWARE && capture_hw_timestamps(interface) != 0) {
+    LOG("Warning: cannot enable hardware timestamps on %s, using software timestamps\n", interface);
+    timestamps = TIMESTAMPS_SOFTWARE;
+  }
+  capture_timestamps(&cap, timestamps);
+
+  // stop on ctrl-c or SIGTERM; without SA_RESTART, so a blocking receive is interrupted
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_recording;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  LOG("Recording %s packets of %lu bytes from port %i with the %s backend to %s\n",
+      science_mode == 0 || science_mode == 2 ? "Stokes I" : "Stokes IQUV", packet_size, port, capture_backend_name(backend), output);
+
+  clock_gettime(CLOCK_REALTIME, &start);
+  while (!stop && !w.error) {
+    if (capture_next_batch(&cap) < 0) {
+      // interrupted, or a partial batch
+      continue;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < cap.npackets && (maxpackets == 0 || npackets < maxpackets); i++) {
+      // packets without a receive timestamp get the time the batch was handed to us
+      arrival = cap.timestamps ? cap.arrival[i] : 0;
+      if (arrival == 0) {
+        arrival = now.tv_sec * 1000000000UL + now.tv_nsec;
+      }
+      writer_packet(&w, cap.packets[i], packet_size, port, arrival);
+      npackets++;
+    }
+    capture_release_batch(&cap);
+
+    if (maxpackets && npackets >= maxpackets) {
+      break;
+    }
+    if (duration > 0 && (now.tv_sec - start.tv_sec) + 1e-9 * (now.tv_nsec - start.tv_nsec) >= duration) {
+      break;
+    }
+  }
+
+  // write the last buffer and wait for the writer thread
+  pthread_mutex_lock(&w.lock);
+  w.filled++;
+  w.stopping = 1;
+  pthread_cond_signal(&w.cond);
+  pthread_mutex_unlock(&w.lock);
+  pthread_join(writer, NULL);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  elapsed = (now.tv_sec - start.tv_sec) + 1e-9 * (now.tv_nsec - start.tv_nsec);
+  if (w.error) {
+    LOG("ERROR: cannot write to %s: %s\n", output, strerror(w.error));
+  }
+  if (close(w.fd) != 0) {
+    LOG("ERROR: cannot close %s: %s\n", output, strerror(errno));
+    w.error = errno;
+  }
+  LOG("Recorded %lu packets in %.1f s (%.3f Gbit/s), kernel drops: %lu\n",
+      npackets, elapsed, elapsed > 0 ? 8e-9 * npackets * packet_size / elapsed : 0.0, capture_drops(&cap));
+
+  for (i = 0; i < RECORD_NBUFFERS; i++) {
+    free(w.data[i]);
+  }
+  free(output);
+  free(interface);
+  exit(w.error ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -2,6 +2,20 @@
  * fake data generation code; used for development and debugging
  * send lots of data to a network port
  *
+ * The science case and mode are looked up in the mode table shared with fill_ringbuffer.
+ * The payloads are filled with the pattern of each packet (see pattern.h), so the ringbuffer pages
+ * can be checked with 'check_page'.
+ *
+ * Packets are sent at the production rate, a multiple of it, a given rate in Gbit/s, or as fast as possible.
+ * Each sender thread sends a range of the channels over its own socket, and paces itself with a token bucket:
+ * it sleeps till its next batch is due, and after falling behind it catches up with bursts of at most SEND_BURST.
+ *
+ * The generated stream can be impaired, reproducibly for a given seed: packets are dropped at random or in
+ * burst gaps, reordered, duplicated, or sent with a bad header. Whether a packet is impaired only depends on
+ * the seed and its position in the stream, so the totals printed are the ground truth for any rate or number of threads.
+ *
+ * With '-r <file>' a pcap file is replayed instead, for example one made with 'record',
+ * at the original speed, faster or slower, or as fast as possible.
  */
 // http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html#theory
 
@@ -12,70 +26,126 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <byteswap.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <netdb.h>
 
+#include "pcap.h"
+#include "packet.h"
+#include "modes.h"
+#include "pattern.h"
 
-#define PACKHEADER 114                   // Size of the packet header = PACKETSIZE-PAYLOADSIZE in bytes
+#define FRAME_NS ((unsigned long) FRAME_TIMESTAMPS * TIMEUNIT_NS)  // Length of a frame, in ns
+#define SEND_BURST 1000000        // Longest burst to catch up after falling behind the rate, in ns
+#define MAX_THREADS 32            // Maximum number of sender threads
 
-#define PACKETSIZE_STOKESI  6364         // Size of the packet, including the header in bytes
-#define PAYLOADSIZE_STOKESI 6250         // Size of the record = packet - header in bytes
+#define SALT_DROP      1          // Salts of the random numbers drawn for a packet, one per impairment
+#define SALT_DUPLICATE 2
+#define SALT_CORRUPT   3
+#define SALT_FIELD     4
+#define SALT_REORDER   5
+#define SALT_GAP       6
 
-#define PACKETSIZE_STOKESIQUV  8114      // Size of the packet, including the header in bytes
-#define PAYLOADSIZE_STOKESIQUV 8000      // Size of the record = packet - header in bytes
+#define BAD_MARKER  1             // Header fields corrupted by the '-B' impairment
+#define BAD_CB      2
+#define BAD_CHANNEL 3
 
-#define PAYLOADSIZE_MAX        8000      // Maximum of payload size of I, IQUV
+/*
+ * Impairments of the generated stream, to test the handling of lost, late and bad packets
+ */
+typedef struct {
+  unsigned long seed;                // Seed of the random numbers
+  double drop;                       // Fraction of packets dropped
+  double duplicate;                  // Fraction of packets sent twice
+  double corrupt;                    // Fraction of packets with a bad marker byte, compound beam or channel
+  int reorder;                       // Packets are sent in random order within a window of this many packets; 0 for none
+  double gap_interval;               // Average time between burst gaps in s; 0 for none
+  double gap_length;                 // Length of a burst gap in ms
+} impair_t;
 
-#define MMSG_VLEN  256            // Batch message into single syscal using recvmmsg()
+/*
+ * A packet of the stream, before it is written to the send buffer
+ */
+typedef struct {
+  unsigned long position;            // Position in the stream, counting the packets of all threads
+  unsigned long timestamp;
+  unsigned short channel;
+  unsigned char tab;
+  unsigned char sequence;
+} slot_t;
 
-#define TIMEUNIT 781250           // Conversion factor of timestamp from seconds to (1.28 us) packets
-#define UMSPPACKET (1000.0)       // sleep time in microseconds between sending two packets
+/*
+ * The stream to send, shared by the sender threads
+ */
+typedef struct {
+  int payload_size;
+  int packet_size;
+  int sequence_length;
+  int ntabs;
+  int channel_delta;
+  unsigned char marker_field;
+  unsigned long startpacket;
+  double frame_ns;                   // Time to send a frame (1.024 s of data) in, in ns; 0 for as fast as possible
+  struct timespec start;             // Time the first packets are due (CLOCK_MONOTONIC)
+  int nthreads;
+  pthread_barrier_t frame;           // Keeps the sender threads at the same frame
+  impair_t impair;
+} stream_t;
 
 /*
- * Header description based on:
- * ARTS Interface Specification from BF to SC3+4
- * ASTRON_SP_066_InterfaceSpecificationSC34.pdf
- * revision 2.0
+ * Per thread sender state
  */
 typedef struct {
-  unsigned char marker_byte;         // See table 3 in PDF, page 6
-  unsigned char format_version;      // Version: 1
-  unsigned char cb_index;            // [0,36] one compound beam per fill_ringbuffer instance:: ignore
-  unsigned char tab_index;           // [0,11] all tabs per fill_ringbuffer instance
-  unsigned short channel_index;      // [0,1535] all channels per fill_ringbuffer instance
-  unsigned short payload_size;       // Stokes I: 6250, IQUV: 8000
-  unsigned long timestamp;           // units of 1.28 us, since 1970-01-01 00:00.000 
-  unsigned char sequence_number;     // SC3: Stokes I: 0-1, Stokes IQUV: 0-24
-                                     // SC4: Stokes I: 0-3, Stokes IQUV: 0-49
-  unsigned char reserved[7];
-  unsigned long flags[3];
-  unsigned char record[PAYLOADSIZE_MAX];
-} packet_t;
+  int id;
+  int sockfd;                        // Socket of this thread
+  pthread_t thread;
+  stream_t *stream;
+  unsigned short channel_first;      // First channel sent by this thread
+  unsigned short channel_end;        // Channel after the last channel sent by this thread
+  atomic_ulong packets;              // Number of packets sent
+  atomic_ulong dropped;              // Number of packets dropped, at random or in a gap
+  atomic_ulong gapped;               // Number of packets dropped in a gap
+  atomic_ulong duplicated;           // Number of packets sent twice
+  atomic_ulong corrupted;            // Number of packets sent with a bad header
+} sender_t;
 
 
 /**
  * Print commandline optinos
  */
 void printOptions() {
-  printf("usage: send -c <science case> -m <science mode> -s <start packet number> -p <port>\n");
+  printf("usage: send -c <science case> -m <science mode> -s <start packet number> -p <port> [-H <host>] [-x <speed> | -g <Gbit/s>] [-t <threads>]\n");
+  printf("       send -r <pcap file> [-x <speed>] -p <port> [-H <host>]\n");
+  printf("\n\nSend to localhost, or to '-H <host>'\n");
+  printf("Send at the production rate of 12500 records per 1.024 s, '-x <speed>' times faster, at '-g <Gbit/s>' of UDP payload, or as fast as possible with '-x 0'\n");
+  printf("Spread the channels over '-t <threads>' sender threads, each with its own socket (default 1, max %i)\n", MAX_THREADS);
+  printf("\nImpair the generated stream, reproducibly for the seed '-S <seed>' (default 0):\n");
+  printf("  -D <fraction>   drop packets at random\n");
+  printf("  -G <s>:<ms>     drop all packets in burst gaps of <ms>, on average every <s>\n");
+  printf("  -R <packets>    send packets in random order within a window, also across frames\n");
+  printf("  -U <fraction>   send packets twice\n");
+  printf("  -B <fraction>   send packets with a bad marker byte, compound beam or channel\n");
+  printf("The number of impaired packets is printed every second; dropped and bad packets are missing in the ringbuffer\n");
+  printf("\nReplay the UDP packets in a pcap file with '-r', at the original speed, '-x <speed>' times faster, or as fast as possible with '-x 0'\n");
   return;
 }
 
 /**
  * Parse commandline
  */
-void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, unsigned long *startpacket, int *port) {
+void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, unsigned long *startpacket, int *port, char **replay, float *speed, float *gbps, int *nthreads, char **host, impair_t *impair) {
   int sets=0, setp=0, setc=0, setm=0;
 
-  // TODO
-  *startpacket = 0;
-  sets = 1;
-
   int c;
-  while((c=getopt(argc,argv,"s:p:c:m:"))!=-1) {
+  while((c=getopt(argc,argv,"s:p:c:m:r:x:g:t:H:S:D:G:R:U:B:"))!=-1) {
     switch(c) {
       // -s start packet number
       case('s'):
@@ -109,6 +179,81 @@ void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, u
         }
         break;
 
+      // -r replay a pcap file
+      case('r'):
+        *replay = strdup(optarg);
+        break;
+
+      // -x speed relative to the production rate or the recording
+      case('x'):
+        *speed = atof(optarg);
+        if (*speed < 0) {
+          fprintf(stderr, "Speed should not be negative\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -g rate in Gbit/s
+      case('g'):
+        *gbps = atof(optarg);
+        if (*gbps <= 0) {
+          fprintf(stderr, "Rate should be positive\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -t number of sender threads
+      case('t'):
+        *nthreads = atoi(optarg);
+        if (*nthreads < 1 || *nthreads > MAX_THREADS) {
+          fprintf(stderr, "Number of threads should be between 1 and %i\n", MAX_THREADS);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -H destination host
+      case('H'):
+        *host = strdup(optarg);
+        break;
+
+      // -S seed of the impairments
+      case('S'):
+        impair->seed = strtoul(optarg, NULL, 0);
+        break;
+
+      // -D fraction of packets dropped
+      case('D'):
+        impair->drop = atof(optarg);
+        break;
+
+      // -G average interval and length of burst gaps
+      case('G'):
+        if (sscanf(optarg, "%lf:%lf", &impair->gap_interval, &impair->gap_length) != 2 ||
+            impair->gap_interval <= 0 || impair->gap_length <= 0) {
+          fprintf(stderr, "Burst gaps should be given as <interval s>:<length ms>\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -R reorder window
+      case('R'):
+        impair->reorder = atoi(optarg);
+        if (impair->reorder < 0) {
+          fprintf(stderr, "Reorder window should not be negative\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      // -U fraction of packets duplicated
+      case('U'):
+        impair->duplicate = atof(optarg);
+        break;
+
+      // -B fraction of packets with a bad header
+      case('B'):
+        impair->corrupt = atof(optarg);
+        break;
+
       default:
         fprintf(stderr, "Illegal option '%c'\n",  c);
         printOptions();
@@ -116,6 +261,11 @@ void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, u
     }
   }
 
+  // A replay only needs the port
+  if (*replay && setp) {
+    return;
+  }
+
   // All arguments are required
   if (!sets || !setp || !setc || !setm) {
     printf( "sets %i setp %i setc %i setm %i\n", sets, setp, setc, setm);
@@ -124,121 +274,27 @@ void parseOptions(int argc, char*argv[], int *science_case, int *science_mode, u
   }
 }
 
-int main(int argc , char *argv[]) {
-  // commandline args
-  int port;
-  int science_mode;        // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
-  int science_case;        // 3 or 4
-  unsigned long startpacket;
-  parseOptions(argc, argv, &science_case, &science_mode, &startpacket, &port);
-
-  // local variables
+/**
+ * Open a UDP socket connected to a port
+ *
+ * @param {const char *} host Host to send to
+ * @param {int} port Network port to send to
+ * @returns {int} socket file descriptor
+ */
+int open_connection(const char *host, int port) {
   int sockfd;
   struct addrinfo hints, *servinfo, *p;
-  int payload_size;
-  int packet_size;
-  int sequence_length = 1;
-  int ntabs = 1;
-  int channel_delta = 1;
-  unsigned char marker_field = 0;
-
-  switch (science_case) {
-    case 3:
-      switch (science_mode) {
-        case 0:
-          // Science case 3, Stokes I + TAB
-          payload_size = PAYLOADSIZE_STOKESI;
-          packet_size = PACKETSIZE_STOKESI;
-          sequence_length = 2;
-          marker_field = 0xD0;
-          ntabs = 9;
-          channel_delta = 1;
-          break;
-        case 1:
-          // Science case 3, Stokes IQUV + TAB
-          payload_size = PAYLOADSIZE_STOKESIQUV;
-          packet_size = PACKETSIZE_STOKESIQUV;
-          sequence_length = 25;
-          marker_field = 0xD1;
-          ntabs = 9;
-          channel_delta = 4;
-          break;
-        case 2:
-          // Science case 3, Stokes I + IAB
-          payload_size = PAYLOADSIZE_STOKESI;
-          packet_size = PACKETSIZE_STOKESI;
-          sequence_length = 2;
-          marker_field = 0xD2;
-          ntabs = 1;
-          channel_delta = 1;
-          break;
-        case 3:
-          // Science case 3, Stokes IQUV + IAB
-          payload_size = PAYLOADSIZE_STOKESIQUV;
-          packet_size = PACKETSIZE_STOKESIQUV;
-          sequence_length = 25;
-          marker_field = 0xD3;
-          ntabs = 1;
-          channel_delta = 4;
-          break;
-      }
-      break;
-
-    case 4:
-      switch (science_mode) {
-        case 0:
-          // Science case 4, Stokes I + TAB
-          payload_size = PAYLOADSIZE_STOKESI;
-          packet_size = PACKETSIZE_STOKESI;
-          sequence_length = 4;
-          marker_field = 0xE0;
-          ntabs = 12;
-          channel_delta = 1;
-          break;
-        case 1:
-          // Science case 4, Stokes IQUV + TAB
-          payload_size = PAYLOADSIZE_STOKESIQUV;
-          packet_size = PACKETSIZE_STOKESIQUV;
-          sequence_length = 50;
-          marker_field = 0xE1;
-          ntabs = 12;
-          channel_delta = 4;
-          break;
-        case 2:
-          // Science case 4, Stokes I + IAB
-          payload_size = PAYLOADSIZE_STOKESI;
-          packet_size = PACKETSIZE_STOKESI;
-          sequence_length = 4;
-          marker_field = 0xE2;
-          ntabs = 1;
-          channel_delta = 1;
-          break;
-        case 3:
-          // Science case 4, Stokes IQUV + IAB
-          payload_size = PAYLOADSIZE_STOKESIQUV;
-          packet_size = PACKETSIZE_STOKESIQUV;
-          sequence_length = 50;
-          marker_field = 0xE3;
-          ntabs = 1;
-          channel_delta = 4;
-          break;
-      }
-      break;
-  }
-  printf("Sending sequence_length=%i packet_size=%i payload_size=%i marker_field=%i channel_delta=%i ntabs=%i\n",
-      sequence_length, packet_size, payload_size, marker_field, channel_delta, ntabs);
+  char service[256];
 
-  // connect to port
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_DGRAM;
 
-  char service[256];
   snprintf(service, 255, "%i", port);
 
   // find possible connections
-  if(getaddrinfo("127.0.0.1", service, &hints, &servinfo) != 0) {
-    perror(NULL);
+  if(getaddrinfo(host, service, &hints, &servinfo) != 0) {
+    fprintf(stderr, "Cannot find host %s\n", host);
     exit(EXIT_FAILURE);
   }
 
@@ -263,30 +319,280 @@ int main(int argc , char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  freeaddrinfo(servinfo);
+  return sockfd;
+}
+
+/**
+ * Replay the UDP packets in a pcap file
+ * The file is memory mapped, and the packets are sent directly from the mapping in batches of MMSG_VLEN.
+ * A batch is sent when its first packet is due: at its arrival time after the first packet in the file, divided by the speed.
+ *
+ * @param {int} sockfd Connected socket to send to
+ * @param {const char *} filename The pcap file
+ * @param {float} speed Replay speed relative to the recording, 0 for as fast as possible
+ */
+void replay_pcap(int sockfd, const char *filename, float speed) {
+  struct iovec iov[MMSG_VLEN];
+  struct mmsghdr msgs[MMSG_VLEN];
+  struct timespec start, due, now;
+  const pcap_record_t *record;
+  const unsigned char *map, *payload;
+  const char *error;
+  size_t size, offset, payload_len;
+  unsigned long frac_ns;            // Length of a unit of ts_frac in ns
+  unsigned long arrival, first = 0, last = 0, batch_arrival = 0, delay;
+  unsigned long npackets = 0, nbytes = 0, skipped = 0;
+  unsigned int linktype;
+  int n, sent, nsent;
+  double elapsed;
+
+  map = pcap_map(filename, &size, &frac_ns, &error);
+  if (!map) {
+    fprintf(stderr, "Cannot replay %s: %s\n", filename, error);
+    exit(EXIT_FAILURE);
+  }
+  linktype = ((const pcap_header_t *) map)->linktype;
+
+  if (speed > 0) {
+    printf("Replaying %s at %.3f times the recorded rate\n", filename, speed);
+  } else {
+    printf("Replaying %s as fast as possible\n", filename);
+  }
+
+  memset(msgs, 0, sizeof(msgs));
+  for (n = 0; n < MMSG_VLEN; n++) {
+    msgs[n].msg_hdr.msg_iov = &iov[n];
+    msgs[n].msg_hdr.msg_iovlen = 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  offset = sizeof(pcap_header_t);
+  n = 0;
+  while (1) {
+    // add the next packet to the batch
+    if (offset + sizeof(pcap_record_t) <= size) {
+      record = (const pcap_record_t *) &map[offset];
+      offset += sizeof(pcap_record_t);
+      if (offset + record->incl_len > size) {
+        fprintf(stderr, "Warning: %s is truncated\n", filename);
+        offset = size;
+        continue;
+      }
+
+      payload = pcap_udp_payload(&map[offset], record->incl_len, linktype, &payload_len);
+      offset += record->incl_len;
+      if (!payload) {
+        skipped++;
+        continue;
+      }
+
+      arrival = record->ts_sec * 1000000000UL + record->ts_frac * frac_ns;
+      if (npackets == 0 && n == 0) {
+        first = arrival;
+      }
+      if (n == 0) {
+        batch_arrival = arrival;
+      }
+      last = arrival;
+
+      iov[n].iov_base = (void *) payload;
+      iov[n].iov_len = payload_len;
+      nbytes += payload_len;
+      n++;
+      if (n < MMSG_VLEN) {
+        continue;
+      }
+    }
+
+    if (n == 0) {
+      break;
+    }
+
+    // wait till the first packet of the batch is due
+    if (speed > 0 && batch_arrival > first) {
+      delay = (batch_arrival - first) / speed;
+      due.tv_sec = start.tv_sec + (start.tv_nsec + delay) / 1000000000UL;
+      due.tv_nsec = (start.tv_nsec + delay) % 1000000000UL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+    }
+
+    // send the batch
+    for (sent = 0; sent < n; sent += nsent) {
+      nsent = sendmmsg(sockfd, &msgs[sent], n - sent, 0);
+      if (nsent == -1) {
+        perror("ERROR Could not send packets");
+        exit(EXIT_FAILURE);
+      }
+    }
+    npackets += n;
+    n = 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - start.tv_sec) + 1e-9 * (now.tv_nsec - start.tv_nsec);
+  printf("Replayed %lu packets (%.3f GB) in %.3f s, recorded in %.3f s: %.3f Gbit/s, skipped %lu packets that are not IPv4 UDP\n",
+      npackets, 1e-9 * nbytes, elapsed, 1e-9 * (last - first), elapsed > 0 ? 8e-9 * nbytes / elapsed : 0.0, skipped);
+
+  munmap((void *) map, size);
+}
+
+/**
+ * Wait till a time, given in ns after a start time
+ *
+ * @param {struct timespec *} start Start time (CLOCK_MONOTONIC)
+ * @param {unsigned long} delay Time after the start in ns
+ */
+void sleep_until(struct timespec *start, unsigned long delay) {
+  struct timespec due;
+
+  due.tv_sec = start->tv_sec + (start->tv_nsec + delay) / 1000000000UL;
+  due.tv_nsec = (start->tv_nsec + delay) % 1000000000UL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+}
+
+/**
+ * Time since a start time
+ *
+ * @param {struct timespec *} start Start time (CLOCK_MONOTONIC)
+ * @returns {unsigned long} Time since the start in ns
+ */
+unsigned long elapsed_ns(struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * Random number for an impairment of a packet
+ * A hash of the seed, the position of the packet and the impairment (splitmix64),
+ * so the same packets are impaired regardless of the rate and the number of threads
+ *
+ * @param {unsigned long} seed Seed of the impairments
+ * @param {unsigned long} position Position of the packet in the stream
+ * @param {unsigned long} salt SALT_* of the impairment
+ * @returns {double} Uniform random number in [0, 1)
+ */
+double random_uniform(unsigned long seed, unsigned long position, unsigned long salt) {
+  unsigned long x = seed ^ (position * 0x9E3779B97F4A7C15UL) ^ (salt << 56);
+
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+  x = x ^ (x >> 31);
+  return (x >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Write a packet to the send buffer: the header, and the pattern of the packet as payload
+ *
+ * @param {stream_t *} stream The stream
+ * @param {packet_t *} packet The packet in the send buffer
+ * @param {slot_t *} slot The packet to write
+ * @param {int} bad BAD_* header field to corrupt, or 0
+ */
+void write_packet(stream_t *stream, packet_t *packet, slot_t *slot, int bad) {
+  // set constant values
+  packet->marker_byte = stream->marker_field;
+  packet->format_version = 1;
+  packet->cb_index = 1;
+  packet->payload_size = bswap_16(stream->payload_size);
+
+  // update non-constant values
+  packet->sequence_number = slot->sequence;
+  packet->tab_index = slot->tab;
+  packet->channel_index = bswap_16(slot->channel);
+  packet->timestamp = bswap_64(slot->timestamp);
+
+  switch (bad) {
+    case BAD_MARKER:
+      packet->marker_byte = ~stream->marker_field;
+      break;
+    case BAD_CB:
+      packet->cb_index = 2;
+      break;
+    case BAD_CHANNEL:
+      packet->channel_index = bswap_16(NCHANNELS + slot->channel);
+      break;
+  }
+
+  pattern_fill(packet->record, stream->payload_size, pattern_key(slot->tab, slot->channel, slot->sequence, slot->timestamp));
+}
+
+/**
+ * Send the channels of a sender thread, frame after frame
+ * Does not return; exits the program when sending fails
+ *
+ * @param {void *} arg The sender_t for this thread
+ */
+void *sender_run(void *arg) {
+  sender_t *self = (sender_t *)arg;
+  stream_t *stream = self->stream;
+  impair_t *impair = &stream->impair;
+
   // multi message setup
-  packet_t packet_buffer[MMSG_VLEN];   // Buffer for batch requesting packets via recvmmsg
+  packet_t *packet_buffer;             // Buffer for batch sending packets via sendmmsg
   unsigned int packet_idx;             // Current packet index in MMSG buffer
-  struct iovec iov[MMSG_VLEN];         // IO vec structure for recvmmsg
-  struct mmsghdr msgs[MMSG_VLEN];      // multimessage hearders for recvmmsg
+  struct iovec iov[MMSG_VLEN];         // IO vec structure for sendmmsg
+  struct mmsghdr msgs[MMSG_VLEN];      // multimessage hearders for sendmmsg
+
+  packet_buffer = calloc(MMSG_VLEN, sizeof(packet_t));
+  if (!packet_buffer) {
+    fprintf(stderr, "Cannot allocate packet buffer\n");
+    exit(EXIT_FAILURE);
+  }
 
   memset(msgs, 0, sizeof(msgs));
   for(packet_idx=0; packet_idx < MMSG_VLEN; packet_idx++) {
     iov[packet_idx].iov_base = (char *) &packet_buffer[packet_idx];
-    iov[packet_idx].iov_len = packet_size;
+    iov[packet_idx].iov_len = stream->packet_size;
 
-    msgs[packet_idx].msg_hdr.msg_name    = NULL; // we don't need to know who sent the data
+    msgs[packet_idx].msg_hdr.msg_name    = NULL; // connected socket
     msgs[packet_idx].msg_hdr.msg_iov     = &iov[packet_idx];
     msgs[packet_idx].msg_hdr.msg_iovlen  = 1;
-    msgs[packet_idx].msg_hdr.msg_control = NULL; // we're not interested in OoB data
+    msgs[packet_idx].msg_hdr.msg_control = NULL;
+  }
+
+  // pacing: every packet of this thread takes an equal share of the frame time
+  unsigned long ngroups = NCHANNELS / stream->channel_delta;
+  unsigned long stream_packets_per_frame = stream->ntabs * stream->sequence_length * ngroups;
+  unsigned long packets_per_frame = stream->ntabs * stream->sequence_length *
+    ((self->channel_end - self->channel_first + stream->channel_delta - 1) / stream->channel_delta);
+  double packet_ns = stream->frame_ns / packets_per_frame;
+  double next = 0;                 // Time the next batch is due, in ns after the start
+  unsigned long now;
+
+  // burst gaps, as positions in the stream; the same for all threads
+  double gap_packets = impair->gap_length * 1e6 / FRAME_NS * stream_packets_per_frame;
+  double gap_interval = impair->gap_interval * 1e9 / FRAME_NS * stream_packets_per_frame;
+  unsigned long gap = 0;           // Number of the current gap
+  double gap_start = 0, gap_end = 0;
+
+  // reorder window
+  slot_t *pool = NULL;
+  int npool = 0;
+  if (impair->reorder) {
+    pool = malloc(impair->reorder * sizeof(slot_t));
+    if (!pool) {
+      fprintf(stderr, "Cannot allocate reorder window\n");
+      exit(EXIT_FAILURE);
+    }
   }
 
   // local counters
-  unsigned short curr_channel = 0;
+  unsigned short curr_channel = self->channel_first;
   unsigned char curr_sequence = 0;
   unsigned char curr_tab = 0;
-  unsigned long curr_time = startpacket;
-
-  packet_t *packet;                // Pointer to current packet
+  unsigned long curr_time = stream->startpacket;
+  unsigned long frame = 0;         // Frames started
+  unsigned long synced = 0;        // Frames synchronized with the other threads
+  unsigned long generated;         // Packets generated for this batch, including the ones dropped
+  unsigned long dropped = 0, gapped = 0, duplicated = 0, corrupted = 0;
+  int repeat = 0;                  // Send the last packet again
+  int bad = 0;                     // Header field of the last packet to corrupt
+  int sent, nsent, j;
+
+  slot_t slot, swap;
   while(1) {
 
     // Create the next MMSB_VLEN packets
@@ -294,50 +600,247 @@ int main(int argc , char *argv[]) {
     // Loop over:
     //  * tab           [0 .. 12]
     //  * sequence      [0 .. sequence_length]
-    //  * channel       [0 .. 1536], in steps of channel_delta
-    for(packet_idx=0; packet_idx < MMSG_VLEN; packet_idx++) {
-      packet = &packet_buffer[packet_idx];
-
-      // set constant values
-      packet->marker_byte = marker_field;
-      packet->format_version = 1;
-      packet->cb_index = 1;
-      packet->payload_size = bswap_16(payload_size);
-
-      // update non-constant values
-      packet->sequence_number = curr_sequence;
-      packet->tab_index = curr_tab;
-      packet->channel_index = bswap_16(curr_channel);
-      packet->timestamp = bswap_64(curr_time);
+    //  * channel       [channel_first .. channel_end], in steps of channel_delta
+    generated = 0;
+    packet_idx = 0;
+    while (packet_idx < MMSG_VLEN) {
+      if (repeat) {
+        repeat = 0;
+        write_packet(stream, &packet_buffer[packet_idx++], &slot, bad);
+        continue;
+      }
+
+      slot.position = frame * stream_packets_per_frame +
+        (curr_tab * stream->sequence_length + curr_sequence) * ngroups + curr_channel / stream->channel_delta;
+      slot.timestamp = curr_time;
+      slot.channel = curr_channel;
+      slot.tab = curr_tab;
+      slot.sequence = curr_sequence;
+      generated++;
 
       // go to next packet
-      curr_channel += channel_delta;
-      if (curr_channel >= 1536) {
-        curr_channel = 0;
+      curr_channel += stream->channel_delta;
+      if (curr_channel >= self->channel_end) {
+        curr_channel = self->channel_first;
         curr_sequence++;
       }
-      if (curr_sequence >= sequence_length) {
+      if (curr_sequence >= stream->sequence_length) {
         curr_sequence = 0;
         curr_tab++;
       }
-      if (curr_tab >= ntabs) {
+      if (curr_tab >= stream->ntabs) {
         curr_tab = 0;
-        curr_time += 800000; // 1.024 seconds per frame, in units of 1.28 microseconds
+        curr_time += FRAME_TIMESTAMPS;
+        frame++;
       }
+
+      // drop the packets in a burst gap, or at random
+      if (gap_interval > 0) {
+        while (slot.position >= gap_end) {
+          gap_start = gap_end + 2 * gap_interval * random_uniform(impair->seed, gap++, SALT_GAP);
+          gap_end = gap_start + gap_packets;
+        }
+        if (slot.position >= gap_start) {
+          gapped++;
+          dropped++;
+          continue;
+        }
+      }
+      if (impair->drop > 0 && random_uniform(impair->seed, slot.position, SALT_DROP) < impair->drop) {
+        dropped++;
+        continue;
+      }
+
+      // hold the packet back in the reorder window, and send a random packet from the window instead
+      if (impair->reorder) {
+        if (npool < impair->reorder) {
+          pool[npool++] = slot;
+          continue;
+        }
+        j = random_uniform(impair->seed, slot.position, SALT_REORDER) * impair->reorder;
+        swap = pool[j];
+        pool[j] = slot;
+        slot = swap;
+      }
+
+      bad = 0;
+      if (impair->corrupt > 0 && random_uniform(impair->seed, slot.position, SALT_CORRUPT) < impair->corrupt) {
+        bad = BAD_MARKER + (int) (3 * random_uniform(impair->seed, slot.position, SALT_FIELD));
+        corrupted++;
+      }
+      if (impair->duplicate > 0 && random_uniform(impair->seed, slot.position, SALT_DUPLICATE) < impair->duplicate) {
+        repeat = 1;
+        duplicated++;
+      }
+      write_packet(stream, &packet_buffer[packet_idx++], &slot, bad);
     }
 
-    // Send next batch of packets
-    if (sendmmsg(sockfd, msgs, MMSG_VLEN, 0) == -1) {
-      perror("ERROR Could not send packets");
-      goto exit;
+    // wait till the batch is due; after falling behind, do not catch up with more than a SEND_BURST burst
+    if (stream->frame_ns > 0) {
+      now = elapsed_ns(&stream->start);
+      if (next > now) {
+        sleep_until(&stream->start, next);
+      } else if (next + SEND_BURST < now) {
+        next = now - SEND_BURST;
+      }
+      next += generated * packet_ns;
     }
 
-    // slow down sending a bit
-    usleep(UMSPPACKET);
+    // Send next batch of packets
+    for (sent = 0; sent < MMSG_VLEN; sent += nsent) {
+      nsent = sendmmsg(self->sockfd, &msgs[sent], MMSG_VLEN - sent, 0);
+      if (nsent == -1) {
+        perror("ERROR Could not send packets");
+        exit(EXIT_FAILURE);
+      }
+    }
+    atomic_fetch_add_explicit(&self->packets, MMSG_VLEN, memory_order_relaxed);
+    atomic_store_explicit(&self->dropped, dropped, memory_order_relaxed);
+    atomic_store_explicit(&self->gapped, gapped, memory_order_relaxed);
+    atomic_store_explicit(&self->duplicated, duplicated, memory_order_relaxed);
+    atomic_store_explicit(&self->corrupted, corrupted, memory_order_relaxed);
+
+    // do not run ahead of the other threads by more than a frame
+    while (synced < frame) {
+      pthread_barrier_wait(&stream->frame);
+      synced++;
+    }
   }
 
-exit:
-  // done, clean up
-  free(servinfo); 
-  close(sockfd);
+  return NULL;
 }
+
+int main(int argc , char *argv[]) {
+  // commandline args
+  int port;
+  int science_mode;        // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
+  int science_case;        // 3 or 4
+  unsigned long startpacket;
+  char *replay = NULL;     // pcap file to replay
+  float speed = 1;         // speed relative to the production rate or the recording, 0 for as fast as possible
+  float gbps = 0;          // rate in Gbit/s, 0 to use the speed
+  int nthreads = 1;        // number of sender threads
+  char *host = NULL;       // host to send to
+  impair_t impair;         // impairments of the generated stream
+  memset(&impair, 0, sizeof(impair));
+  parseOptions(argc, argv, &science_case, &science_mode, &startpacket, &port, &replay, &speed, &gbps, &nthreads, &host, &impair);
+  if (!host) {
+    host = strdup("127.0.0.1");
+  }
+
+  // local variables
+  int sockfd;
+  int payload_size;
+  int packet_size;
+  int sequence_length;
+  int ntabs;
+  int channel_delta;
+  unsigned char marker_field;
+  const science_mode_t *mode;
+
+  // replay a recording instead of generating packets
+  if (replay) {
+    sockfd = open_connection(host, port);
+    replay_pcap(sockfd, replay, speed);
+    close(sockfd);
+    free(replay);
+    exit(EXIT_SUCCESS);
+  }
+
+  mode = science_mode_lookup(science_case, science_mode);
+  if (!mode) {
+    fprintf(stderr, "Illegal science case %i or mode %i\n", science_case, science_mode);
+    exit(EXIT_FAILURE);
+  }
+  payload_size = mode->payload_size;
+  packet_size = offsetof(packet_t, record) + payload_size;
+  sequence_length = mode->sequence_length;
+  marker_field = mode->marker_byte;
+  ntabs = mode->ntabs;
+  channel_delta = mode->channels_per_packet;
+  printf("Sending sequence_length=%i packet_size=%i payload_size=%i marker_field=%i channel_delta=%i ntabs=%i\n",
+      sequence_length, packet_size, payload_size, marker_field, channel_delta, ntabs);
+
+  // the stream, and the time to send a frame in
+  stream_t stream;
+  stream.payload_size = payload_size;
+  stream.packet_size = packet_size;
+  stream.sequence_length = sequence_length;
+  stream.ntabs = ntabs;
+  stream.channel_delta = channel_delta;
+  stream.marker_field = marker_field;
+  stream.startpacket = startpacket;
+  stream.nthreads = nthreads;
+  stream.impair = impair;
+
+  unsigned long packets_per_frame = ntabs * sequence_length * (NCHANNELS / channel_delta);
+  if (gbps > 0) {
+    stream.frame_ns = packets_per_frame * packet_size * 8 / gbps;
+  } else if (speed > 0) {
+    stream.frame_ns = FRAME_NS / speed;
+  } else {
+    stream.frame_ns = 0;
+  }
+  if (stream.frame_ns > 0) {
+    printf("Sending %lu packets per frame, a frame per %.3f s: %.3f Gbit/s, %.3f times the production rate\n",
+        packets_per_frame, 1e-9 * stream.frame_ns, 8.0 * packets_per_frame * packet_size / stream.frame_ns, FRAME_NS / stream.frame_ns);
+  } else {
+    printf("Sending %lu packets per frame, as fast as possible\n", packets_per_frame);
+  }
+  int impaired = impair.drop > 0 || impair.gap_interval > 0 || impair.reorder || impair.duplicate > 0 || impair.corrupt > 0;
+  if (impaired) {
+    printf("Impairments with seed %lu: drop %g, burst gaps of %g ms every %g s, reorder window %i, duplicate %g, bad header %g\n",
+        impair.seed, impair.drop, impair.gap_length, impair.gap_interval, impair.reorder, impair.duplicate, impair.corrupt);
+  }
+  if (nthreads > NCHANNELS / channel_delta) {
+    nthreads = NCHANNELS / channel_delta;
+  }
+  pthread_barrier_init(&stream.frame, NULL, nthreads);
+
+  // start the sender threads, each with its own socket and range of channels
+  sender_t senders[MAX_THREADS];
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &stream.start);
+  for (i = 0; i < nthreads; i++) {
+    senders[i].id = i;
+    senders[i].stream = &stream;
+    senders[i].sockfd = open_connection(host, port);
+    senders[i].channel_first = i * (NCHANNELS / channel_delta) / nthreads * channel_delta;
+    senders[i].channel_end = (i + 1) * (NCHANNELS / channel_delta) / nthreads * channel_delta;
+    atomic_init(&senders[i].packets, 0);
+    atomic_init(&senders[i].dropped, 0);
+    atomic_init(&senders[i].gapped, 0);
+    atomic_init(&senders[i].duplicated, 0);
+    atomic_init(&senders[i].corrupted, 0);
+    if (pthread_create(&senders[i].thread, NULL, sender_run, &senders[i]) != 0) {
+      fprintf(stderr, "Cannot start sender thread %i\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // report the achieved rate every second
+  unsigned long packets, reported = 0;
+  unsigned long dropped, gapped, duplicated, corrupted;
+  unsigned long now, last = 0;
+  while (1) {
+    sleep(1);
+    packets = dropped = gapped = duplicated = corrupted = 0;
+    for (i = 0; i < nthreads; i++) {
+      packets += atomic_load_explicit(&senders[i].packets, memory_order_relaxed);
+      dropped += atomic_load_explicit(&senders[i].dropped, memory_order_relaxed);
+      gapped += atomic_load_explicit(&senders[i].gapped, memory_order_relaxed);
+      duplicated += atomic_load_explicit(&senders[i].duplicated, memory_order_relaxed);
+      corrupted += atomic_load_explicit(&senders[i].corrupted, memory_order_relaxed);
+    }
+    now = elapsed_ns(&stream.start);
+    printf("Sent %lu packets: %.3f Gbit/s, %.3f times the production rate\n", packets,
+        8.0 * (packets - reported) * packet_size / (now - last), 1.0 * (packets - reported) / packets_per_frame * FRAME_NS / (now - last));
+    if (impaired) {
+      printf("Impaired: dropped %lu (%lu in gaps), duplicated %lu, bad header %lu\n", dropped, gapped, duplicated, corrupted);
+    }
+    fflush(stdout);
+    reported = packets;
+    last = now;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+/**
+ * Run statistics of fill_ringbuffer in POSIX shared memory, for live monitoring
+ *
+ */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+const char *bad_reasons[NBAD] = {"marker", "version", "cb", "tab", "channel", "sequence", "payload"};
+
+/**
+ * Create (or reuse) the shared memory segment for the statistics, and initialize it
+ *
+ * @param {const char *} name Name of the segment, for example "/fill_ringbuffer"
+ * @returns {stats_t *} The statistics, or NULL on error
+ */
+stats_t *stats_create(const char *name) {
+  stats_t *stats;
+  int fd;
+
+  fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(stats_t)) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    return NULL;
+  }
+
+  // a reader of a previous run sees an update in progress till the first publish
+  atomic_store(&stats->sequence, atomic_load(&stats->sequence) | 1);
+  return stats;
+}
+
+/**
+ * Open the shared memory segment of the statistics for reading
+ *
+ * @param {const char *} name Name of the segment
+ * @returns {stats_t *} The statistics, or NULL on error
+ */
+stats_t *stats_open(const char *name) {
+  stats_t *stats;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  stats = mmap(NULL, sizeof(stats_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    return NULL;
+  }
+  return stats;
+}
+
+/**
+ * Publish new statistics; only one thread should publish
+ *
+ * @param {stats_t *} shared The shared statistics
+ * @param {stats_t *} values The new values, its sequence field is ignored
+ */
+void stats_publish(stats_t *shared, const stats_t *values) {
+  unsigned int sequence = atomic_load_explicit(&shared->sequence, memory_order_relaxed) | 1;
+
+  // odd: update in progress
+  atomic_store_explicit(&shared->sequence, sequence, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  memcpy((char *)shared + sizeof(atomic_uint), (const char *)values + sizeof(atomic_uint), sizeof(stats_t) - sizeof(atomic_uint));
+
+  // even: done
+  atomic_store_explicit(&shared->sequence, sequence + 1, memory_order_release);
+}
+
+/**
+ * Read a consistent copy of the statistics, retrying while the writer is updating them
+ *
+ * @param {stats_t *} shared The shared statistics
+ * @param {stats_t *} values Set to the current values
+ * @returns {int} 0 on success, -1 when no consistent copy could be made within a second, for example when the writer was killed during an update
+ */
+int stats_read(const stats_t *shared, stats_t *values) {
+  unsigned int before, after;
+  int attempt;
+
+  for (attempt = 0; attempt < 10000; attempt++) {
+    before = atomic_load_explicit((atomic_uint *)&shared->sequence, memory_order_acquire);
+    if (before & 1) {
+      usleep(100);
+      continue;
+    }
+
+    memcpy(values, shared, sizeof(stats_t));
+
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit((atomic_uint *)&shared->sequence, memory_order_relaxed);
+    if (before == after) {
+      return 0;
+    }
+  }
+  return -1;
+}
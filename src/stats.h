@@ -0,0 +1,61 @@
+/**
+ * Run statistics of fill_ringbuffer in POSIX shared memory, for live monitoring
+ *
+ * A single writer publishes the statistics a few times per second; readers never block it.
+ * The structure is protected by a sequence lock: the writer makes 'sequence' odd while it updates
+ * the fields, and readers retry when the sequence was odd or changed while they copied them.
+ * All counters are totals since the start of the process.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#include "fill_ringbuffer.h"
+
+#define STATS_VERSION 1           // Increment on every change of stats_t
+#define STATS_MAX_TABS 12         // Maximum number of tabs, SC4
+
+typedef struct {
+  atomic_uint sequence;                      // Odd while the writer is updating
+  unsigned int version;                      // STATS_VERSION
+  unsigned int size;                         // Size of this structure in bytes
+  int pid;                                   // Process id of the writer
+  int port;                                  // Network port
+  int nreceivers;                            // Number of receiver threads
+  int science_mode;                          // 0: I+TAB, 1: IQUV+TAB, 2: I+IAB, 3: IQUV+IAB
+  int ntabs;                                 // Number of tabs
+  int cb_index;                              // Compound beam index of the current or last observation
+  int running;                               // Is an observation running
+  unsigned long updated;                     // Time of the last update, in ns since the epoch
+
+  unsigned long startpacket;                 // Start of the current or last observation
+  unsigned long endpacket;                   // End of the current or last observation
+  unsigned long timestamp;                   // Timestamp of the last released page
+
+  unsigned long packets;                     // Packets received while running, including bad, late, and duplicate packets
+  unsigned long batches;                     // Batches received while running; packets / batches is the batch fill
+  unsigned long pages;                       // Released pages
+  unsigned long expected;                    // Packets expected in the released pages
+  unsigned long missing;                     // Packets missing in the released pages
+  unsigned long late;                        // Packets for pages that were already released
+  unsigned long duplicates;                  // Packets that were received more than once
+  unsigned long bad[NBAD];                   // Packets with a bad header, per reason
+  unsigned long kernel_drops;                // Packets dropped by the kernel during the released pages
+
+  unsigned long rotations;                   // Page rotations
+  unsigned long rotation_ns;                 // Total time spent rotating pages, in ns
+  unsigned long rotation_ns_max;             // Longest page rotation, in ns
+
+  unsigned long missing_tab[STATS_MAX_TABS]; // Packets missing per tab
+  unsigned long missing_channel[NCHANNELS];  // Packets missing per channel; Stokes IQUV packets count for their first channel
+} stats_t;
+
+extern const char *bad_reasons[NBAD];
+
+stats_t *stats_create(const char *name);
+stats_t *stats_open(const char *name);
+void stats_publish(stats_t *shared, const stats_t *values);
+int stats_read(const stats_t *shared, stats_t *values);
+
+#endif
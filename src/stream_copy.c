@@ -0,0 +1,190 @@
+/**
+ * Copy payloads to the ringbuffer page with non-temporal (streaming) stores
+ *
+ * All kernels copy an unaligned head with memcpy till the destination is aligned to the vector size,
+ * then stream whole vectors with unaligned loads, and copy the tail with memcpy.
+ * Stokes I payloads are 6250 bytes, so their destinations are only 2-byte aligned.
+ *
+ * Streaming stores are weakly ordered: a thread should call stream_fence()
+ * before another thread or process may read the data it copied.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "stream_copy.h"
+
+static void copy_memcpy(void *dest, const void *src, size_t len) {
+  memcpy(dest, src, len);
+}
+
+static void copy_sse2(void *dest, const void *src, size_t len) {
+  char *d = dest;
+  const char *s = src;
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+  if (head >= len) {
+    memcpy(d, s, len);
+    return;
+  }
+  memcpy(d, s, head);
+  d += head; s += head; len -= head;
+
+  while (len >= 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(s +  0));
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+    __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+    _mm_stream_si128((__m128i *)(d +  0), a);
+    _mm_stream_si128((__m128i *)(d + 16), b);
+    _mm_stream_si128((__m128i *)(d + 32), c);
+    _mm_stream_si128((__m128i *)(d + 48), e);
+    d += 64; s += 64; len -= 64;
+  }
+  while (len >= 16) {
+    _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    d += 16; s += 16; len -= 16;
+  }
+  memcpy(d, s, len);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(void *dest, const void *src, size_t len) {
+  char *d = dest;
+  const char *s = src;
+  size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+
+  if (head >= len) {
+    memcpy(d, s, len);
+    return;
+  }
+  memcpy(d, s, head);
+  d += head; s += head; len -= head;
+
+  while (len >= 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(s +  0));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+    __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+    _mm256_stream_si256((__m256i *)(d +  0), a);
+    _mm256_stream_si256((__m256i *)(d + 32), b);
+    _mm256_stream_si256((__m256i *)(d + 64), c);
+    _mm256_stream_si256((__m256i *)(d + 96), e);
+    d += 128; s += 128; len -= 128;
+  }
+  while (len >= 32) {
+    _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    d += 32; s += 32; len -= 32;
+  }
+  memcpy(d, s, len);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512(void *dest, const void *src, size_t len) {
+  char *d = dest;
+  const char *s = src;
+  size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+
+  if (head >= len) {
+    memcpy(d, s, len);
+    return;
+  }
+  memcpy(d, s, head);
+  d += head; s += head; len -= head;
+
+  while (len >= 256) {
+    __m512i a = _mm512_loadu_si512((const void *)(s +   0));
+    __m512i b = _mm512_loadu_si512((const void *)(s +  64));
+    __m512i c = _mm512_loadu_si512((const void *)(s + 128));
+    __m512i e = _mm512_loadu_si512((const void *)(s + 192));
+    _mm512_stream_si512((void *)(d +   0), a);
+    _mm512_stream_si512((void *)(d +  64), b);
+    _mm512_stream_si512((void *)(d + 128), c);
+    _mm512_stream_si512((void *)(d + 192), e);
+    d += 256; s += 256; len -= 256;
+  }
+  while (len >= 64) {
+    _mm512_stream_si512((void *)d, _mm512_loadu_si512((const void *)s));
+    d += 64; s += 64; len -= 64;
+  }
+  memcpy(d, s, len);
+}
+
+stream_copy_t stream_copy = copy_memcpy;
+
+static const char *kernel_names[] = {"memcpy", "sse2", "avx2", "avx512"};
+
+/**
+ * Parse a copy kernel name
+ *
+ * @param {char *} name One of auto, memcpy, sse2, avx2, avx512
+ * @returns {int} The kernel, or -2 for an unknown name
+ */
+int stream_copy_kernel(const char *name) {
+  int k;
+
+  if (strcmp(name, "auto") == 0) {
+    return STREAM_COPY_AUTO;
+  }
+  for (k = 0; k < sizeof(kernel_names) / sizeof(char *); k++) {
+    if (strcmp(name, kernel_names[k]) == 0) {
+      return k;
+    }
+  }
+  return -2;
+}
+
+const char *stream_copy_name(int kernel) {
+  return kernel_names[kernel];
+}
+
+/**
+ * Can the kernel run on this CPU?
+ */
+int stream_copy_supported(int kernel) {
+  __builtin_cpu_init();
+  switch (kernel) {
+    case STREAM_COPY_AVX512:
+      return __builtin_cpu_supports("avx512f");
+    case STREAM_COPY_AVX2:
+      return __builtin_cpu_supports("avx2");
+    default:
+      return 1;
+  }
+}
+
+stream_copy_t stream_copy_get(int kernel) {
+  switch (kernel) {
+    case STREAM_COPY_AVX512: return copy_avx512;
+    case STREAM_COPY_AVX2:   return copy_avx2;
+    case STREAM_COPY_SSE2:   return copy_sse2;
+    default:                 return copy_memcpy;
+  }
+}
+
+/**
+ * Select the copy kernel
+ *
+ * @param {int} kernel The kernel to use, or STREAM_COPY_AUTO for the widest supported one
+ * @returns {int} The selected kernel, or -1 when the requested kernel is not supported
+ */
+int stream_copy_init(int kernel) {
+  if (kernel == STREAM_COPY_AUTO) {
+    kernel = STREAM_COPY_AVX512;
+    while (!stream_copy_supported(kernel)) {
+      kernel--;
+    }
+  } else if (!stream_copy_supported(kernel)) {
+    return -1;
+  }
+
+  stream_copy = stream_copy_get(kernel);
+  return kernel;
+}
+
+/**
+ * Order the streaming stores of this thread before its later stores
+ */
+void stream_fence() {
+  _mm_sfence();
+}
@@ -0,0 +1,31 @@
+/**
+ * Copy payloads to the ringbuffer page with non-temporal (streaming) stores
+ *
+ * The page is not read until the downstream consumer maps it, so the payloads bypass the cache,
+ * keeping the packet buffers of the receivers cached.
+ * The kernel is selected at runtime from the instruction sets supported by the CPU.
+ */
+#ifndef STREAM_COPY_H
+#define STREAM_COPY_H
+
+#include <stddef.h>
+
+#define STREAM_COPY_AUTO   -1
+#define STREAM_COPY_MEMCPY  0
+#define STREAM_COPY_SSE2    1
+#define STREAM_COPY_AVX2    2
+#define STREAM_COPY_AVX512  3
+
+typedef void (*stream_copy_t)(void *dest, const void *src, size_t len);
+
+// The selected copy kernel, memcpy until stream_copy_init is called
+extern stream_copy_t stream_copy;
+
+int stream_copy_kernel(const char *name);
+const char *stream_copy_name(int kernel);
+int stream_copy_supported(int kernel);
+int stream_copy_init(int kernel);
+stream_copy_t stream_copy_get(int kernel);
+void stream_fence();
+
+#endif
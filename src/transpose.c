@@ -0,0 +1,73 @@
+/**
+ * Transpose Stokes IQUV payloads to channel-major time series
+ *
+ * The payload is a matrix of IQUV_SAMPLES rows (time) of 16 bytes (channel, stokes).
+ * It is transposed in blocks of 16x16 bytes held in SSE2 registers,
+ * with four rounds of unpacking that interleave 1, 2, 4 and 8 bytes.
+ * The time series are collected in a buffer on the stack, and then streamed to the page,
+ * which avoids reading the destination cache lines for the partial writes.
+ */
+#include <emmintrin.h>
+
+#include "transpose.h"
+#include "stream_copy.h"
+
+/**
+ * Transpose a payload and write the 16 time series to the page
+ *
+ * @param {char *} dest Destination of the first time sample of stokes I, of the first channel of the payload
+ * @param {unsigned char *} record The payload
+ * @param {size_t} stokes_stride Bytes between the time series of two stokes parameters
+ * @param {size_t} channel_stride Bytes between the time series of two channels
+ */
+void transpose_iquv(char *dest, const unsigned char *record, size_t stokes_stride, size_t channel_stride) {
+  __m128i x[16], a[16], b[16], c[16];
+  unsigned char out[16][(IQUV_SAMPLES + 15) & ~15] __attribute__((aligned(16)));
+  int t, i, k;
+
+  for (t = 0; t + 16 <= IQUV_SAMPLES; t += 16) {
+    for (i = 0; i < 16; i++) {
+      x[i] = _mm_loadu_si128((const __m128i *)(record + (t + i) * 16));
+    }
+
+    // a[2i + h]: rows 2i, 2i+1; columns 8h .. 8h+7
+    for (i = 0; i < 8; i++) {
+      a[2 * i + 0] = _mm_unpacklo_epi8(x[2 * i], x[2 * i + 1]);
+      a[2 * i + 1] = _mm_unpackhi_epi8(x[2 * i], x[2 * i + 1]);
+    }
+
+    // b[4j + 2h + q]: rows 4j .. 4j+3; columns 8h+4q .. 8h+4q+3
+    for (i = 0; i < 4; i++) {
+      for (k = 0; k < 2; k++) {
+        b[4 * i + 2 * k + 0] = _mm_unpacklo_epi16(a[4 * i + k], a[4 * i + 2 + k]);
+        b[4 * i + 2 * k + 1] = _mm_unpackhi_epi16(a[4 * i + k], a[4 * i + 2 + k]);
+      }
+    }
+
+    // c[8m + 2n + r]: rows 8m .. 8m+7; columns 4n+2r, 4n+2r+1
+    for (i = 0; i < 2; i++) {
+      for (k = 0; k < 4; k++) {
+        c[8 * i + 2 * k + 0] = _mm_unpacklo_epi32(b[8 * i + k], b[8 * i + 4 + k]);
+        c[8 * i + 2 * k + 1] = _mm_unpackhi_epi32(b[8 * i + k], b[8 * i + 4 + k]);
+      }
+    }
+
+    // rows 0 .. 15 of columns 2k, 2k+1
+    for (k = 0; k < 8; k++) {
+      _mm_store_si128((__m128i *)(out[2 * k + 0] + t), _mm_unpacklo_epi64(c[k], c[8 + k]));
+      _mm_store_si128((__m128i *)(out[2 * k + 1] + t), _mm_unpackhi_epi64(c[k], c[8 + k]));
+    }
+  }
+
+  // remaining time samples
+  for (; t < IQUV_SAMPLES; t++) {
+    for (k = 0; k < 16; k++) {
+      out[k][t] = record[t * 16 + k];
+    }
+  }
+
+  // write the time series for column k = channel * 4 + stokes
+  for (k = 0; k < 16; k++) {
+    stream_copy(dest + (k % 4) * stokes_stride + (k / 4) * channel_stride, out[k], IQUV_SAMPLES);
+  }
+}
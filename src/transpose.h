@@ -0,0 +1,17 @@
+/**
+ * Transpose Stokes IQUV payloads to channel-major time series while placing them in the page
+ *
+ * A payload contains [IQUV_SAMPLES][4 channels][4 stokes] bytes.
+ * The transposed page contains [tab][stokes][NCHANNELS][sequence_length * IQUV_SAMPLES] bytes,
+ * so a payload is written as 16 runs of IQUV_SAMPLES bytes, one per (stokes, channel).
+ */
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include <stddef.h>
+
+#define IQUV_SAMPLES 500            // Number of time samples in a Stokes IQUV payload
+
+void transpose_iquv(char *dest, const unsigned char *record, size_t stokes_stride, size_t channel_stride);
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * Batch validation of packet headers
+ *
+ * The first 8 bytes of the header are, in network order:
+ *   marker byte, format version, cb index, tab index, channel index (2 bytes), payload size (2 bytes)
+ *
+ * With AVX-512 the headers of 8 packets are gathered into vector registers, and checked at once.
+ */
+#include <string.h>
+#include <byteswap.h>
+#include <immintrin.h>
+
+#include "validate.h"
+
+/**
+ * Set the expected header values
+ *
+ * @param {header_check_t *} check The check to initialize
+ * @param {unsigned char} marker_byte Expected marker byte
+ * @param {unsigned char} cb_index Expected compound beam index
+ * @param {unsigned short} payload_size Expected payload size
+ * @param {int} ntabs Number of tabs
+ * @param {int} sequence_length Number of packets per channel and timestamp
+ */
+void header_check_init(header_check_t *check, unsigned char marker_byte, unsigned char cb_index, unsigned short payload_size, int ntabs, int sequence_length) {
+  unsigned char prefix[8] = {marker_byte, 1, cb_index, 0, 0, 0, payload_size >> 8, payload_size & 0xff};
+  unsigned char mask[8] = {0xff, 0xff, 0xff, 0, 0, 0, 0xff, 0xff};
+
+  memcpy(&check->prefix, prefix, 8);
+  memcpy(&check->mask, mask, 8);
+  check->marker_byte = marker_byte;
+  check->cb_index = cb_index;
+  check->payload_size = payload_size;
+  check->ntabs = ntabs;
+  check->sequence_length = sequence_length;
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    check->validate = validate_headers_avx512;
+    check->batched = 1;
+  } else {
+    // the scalar batch costs more per packet than check_header (see 'bench -b headers')
+    check->validate = validate_headers_scalar;
+    check->batched = 0;
+  }
+}
+
+/**
+ * Validate the headers of a batch of packets, and extract the timestamps and channel indices
+ * Scalar version, without branches
+ *
+ * @param {header_check_t *} check Expected header values
+ * @param {packet_t **} packets The packets
+ * @param {int} npackets Number of packets, at most VALIDATE_BATCH
+ * @param {unsigned long *} timestamps Set to the timestamp of each packet, in host order
+ * @param {unsigned short *} channels Set to the channel index of each packet, in host order
+ * @returns {uint64_t} Bitmask with a bit set for each valid packet
+ */
+uint64_t validate_headers_scalar(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels) {
+  uint64_t valid = 0;
+  int i;
+
+  for (i = 0; i < npackets; i++) {
+    const packet_t *packet = packets[i];
+    uint64_t w;
+    unsigned int tab, channel;
+
+    memcpy(&w, packet, 8);
+    tab = (w >> 24) & 0xff;
+    channel = bswap_16((w >> 32) & 0xffff);
+
+    timestamps[i] = bswap_64(packet->timestamp);
+    channels[i] = channel;
+
+    valid |= (uint64_t) (((w & check->mask) == check->prefix) & (tab < check->ntabs) &
+        (channel < NCHANNELS) & (packet->sequence_number < check->sequence_length)) << i;
+  }
+
+  return valid;
+}
+
+/**
+ * Validate the headers of a batch of packets, and extract the timestamps and channel indices
+ * AVX-512 version, 8 packets at a time
+ *
+ * @param {header_check_t *} check Expected header values
+ * @param {packet_t **} packets The packets
+ * @param {int} npackets Number of packets, at most VALIDATE_BATCH
+ * @param {unsigned long *} timestamps Set to the timestamp of each packet, in host order
+ * @param {unsigned short *} channels Set to the channel index of each packet, in host order
+ * @returns {uint64_t} Bitmask with a bit set for each valid packet
+ */
+__attribute__((target("avx512f,avx512bw")))
+uint64_t validate_headers_avx512(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels) {
+  const __m512i mask = _mm512_set1_epi64(check->mask);
+  const __m512i prefix = _mm512_set1_epi64(check->prefix);
+  const __m512i ntabs = _mm512_set1_epi64(check->ntabs);
+  const __m512i nchannels = _mm512_set1_epi64(NCHANNELS);
+  const __m512i sequence_length = _mm512_set1_epi64(check->sequence_length);
+  const __m512i byte = _mm512_set1_epi64(0xff);
+  // reverse the bytes of each 64-bit lane
+  const __m512i bswap = _mm512_set_epi8(
+      56, 57, 58, 59, 60, 61, 62, 63, 48, 49, 50, 51, 52, 53, 54, 55,
+      40, 41, 42, 43, 44, 45, 46, 47, 32, 33, 34, 35, 36, 37, 38, 39,
+      24, 25, 26, 27, 28, 29, 30, 31, 16, 17, 18, 19, 20, 21, 22, 23,
+       8,  9, 10, 11, 12, 13, 14, 15,  0,  1,  2,  3,  4,  5,  6,  7);
+  uint64_t valid = 0;
+  int i;
+
+  for (i = 0; i + 8 <= npackets; i += 8) {
+    // gather the first 24 bytes of the headers, using the packet pointers as indices
+    __m512i ptr = _mm512_loadu_si512((const void *)&packets[i]);
+    __m512i w = _mm512_i64gather_epi64(ptr, (const void *)offsetof(packet_t, marker_byte), 1);
+    __m512i timestamp = _mm512_i64gather_epi64(ptr, (const void *)offsetof(packet_t, timestamp), 1);
+    __m512i sequence_number = _mm512_and_si512(_mm512_i64gather_epi64(ptr, (const void *)offsetof(packet_t, sequence_number), 1), byte);
+
+    __m512i tab = _mm512_and_si512(_mm512_srli_epi64(w, 24), byte);
+    __m512i channel = _mm512_or_si512(
+        _mm512_and_si512(_mm512_srli_epi64(w, 40), byte),
+        _mm512_slli_epi64(_mm512_and_si512(_mm512_srli_epi64(w, 32), byte), 8));
+
+    __mmask8 ok = _mm512_cmpeq_epi64_mask(_mm512_and_si512(w, mask), prefix);
+    ok &= _mm512_cmplt_epu64_mask(tab, ntabs);
+    ok &= _mm512_cmplt_epu64_mask(channel, nchannels);
+    ok &= _mm512_cmplt_epu64_mask(sequence_number, sequence_length);
+
+    _mm512_storeu_si512((void *)&timestamps[i], _mm512_shuffle_epi8(timestamp, bswap));
+    _mm_storeu_si128((__m128i *)&channels[i], _mm512_cvtepi64_epi16(channel));
+    valid |= (uint64_t) ok << i;
+  }
+
+  // remaining packets
+  if (i < npackets) {
+    valid |= validate_headers_scalar(check, &packets[i], npackets - i, &timestamps[i], &channels[i]) << i;
+  }
+
+  return valid;
+}
+
+/**
+ * Validate the headers of a batch of packets, and extract the timestamps and channel indices
+ * Uses the fastest version supported by the CPU
+ *
+ * @param {header_check_t *} check Expected header values, see header_check_init
+ * @param {packet_t **} packets The packets
+ * @param {int} npackets Number of packets, at most VALIDATE_BATCH
+ * @param {unsigned long *} timestamps Set to the timestamp of each packet, in host order
+ * @param {unsigned short *} channels Set to the channel index of each packet, in host order
+ * @returns {uint64_t} Bitmask with a bit set for each valid packet
+ */
+uint64_t validate_headers(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels) {
+  return check->validate(check, packets, npackets, timestamps, channels);
+}
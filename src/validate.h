@@ -0,0 +1,73 @@
+/**
+ * Batch validation of packet headers
+ *
+ * The constant part of the header (marker byte, format version, compound beam index and payload size)
+ * is compared as a single masked 64-bit word; the tab index, channel index and sequence number are
+ * range checked. With AVX-512, 8 headers are gathered and checked at once.
+ * Without AVX-512 a batch is not faster than checking the packets one by one with check_header.
+ */
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <byteswap.h>
+
+#include "fill_ringbuffer.h"
+
+#define VALIDATE_BATCH 64         // Maximum number of packets per call, one bit per packet in the result
+
+typedef struct header_check header_check_t;
+
+struct header_check {
+  uint64_t prefix;                // Expected first 8 bytes of the header, after masking
+  uint64_t mask;                  // Bytes of the first 8 bytes of the header that are constant
+  unsigned char marker_byte;
+  unsigned char cb_index;
+  unsigned short payload_size;
+  int ntabs;
+  int sequence_length;
+  int batched;                    // Validating per batch is faster than per packet on this CPU
+  // Validation function for this CPU
+  uint64_t (*validate)(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels);
+};
+
+void header_check_init(header_check_t *check, unsigned char marker_byte, unsigned char cb_index, unsigned short payload_size, int ntabs, int sequence_length);
+uint64_t validate_headers_scalar(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels);
+uint64_t validate_headers_avx512(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels);
+uint64_t validate_headers(const header_check_t *check, packet_t * const *packets, int npackets, unsigned long *timestamps, unsigned short *channels);
+
+/**
+ * Check the header of a single packet, field by field
+ * Inline, as it is called per packet
+ *
+ * @param {header_check_t *} check Expected header values
+ * @param {packet_t *} packet The packet
+ * @returns {int} -1 for a valid header, otherwise the BAD_ reason of the first wrong field
+ */
+static inline int check_header(const header_check_t *check, const packet_t *packet) {
+  if (packet->marker_byte != check->marker_byte) {
+    return BAD_MARKER;
+  }
+  if (packet->format_version != 1) {
+    return BAD_VERSION;
+  }
+  if (packet->cb_index != check->cb_index) {
+    return BAD_CB;
+  }
+  if (packet->tab_index >= check->ntabs) {
+    return BAD_TAB;
+  }
+  if (bswap_16(packet->channel_index) >= NCHANNELS) {
+    return BAD_CHANNEL;
+  }
+  if (packet->sequence_number >= check->sequence_length) {
+    return BAD_SEQUENCE;
+  }
+  if (packet->payload_size != bswap_16(check->payload_size)) {
+    return BAD_PAYLOAD;
+  }
+  return -1;
+}
+
+#endif
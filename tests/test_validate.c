@@ -0,0 +1,185 @@
+/**
+ * Test the batch validation of packet headers against the per packet check
+ *
+ * Every header field is corrupted in turn, on batches of all sizes, and the scalar and AVX-512
+ * batch validation should agree with check_header on which packets are valid, and on their
+ * timestamps and channels.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <byteswap.h>
+
+#include "validate.h"
+
+#define MARKER_BYTE 0xd0
+#define CB_INDEX 7
+#define NTABS 9
+#define SEQUENCE_LENGTH 2
+#define NFIELDS 7
+
+int failures = 0;
+
+/**
+ * Fill a packet with a valid header; the indices run over the edges of the valid ranges
+ *
+ * @param {packet_t *} packet The packet
+ * @param {int} i Index of the packet in the batch
+ */
+void valid_header(packet_t *packet, int i) {
+  memset(packet, 0, APPHEADER);
+  packet->marker_byte = MARKER_BYTE;
+  packet->format_version = 1;
+  packet->cb_index = CB_INDEX;
+  packet->tab_index = (NTABS - 1 - i) % NTABS;
+  packet->channel_index = bswap_16((NCHANNELS - 1 - 37 * i) % NCHANNELS);
+  packet->payload_size = bswap_16(PAYLOADSIZE_STOKESI);
+  packet->timestamp = bswap_64(1600000UL + 1000 * i);
+  packet->sequence_number = i % SEQUENCE_LENGTH;
+}
+
+/**
+ * Corrupt one field of a packet header, in one of a few ways
+ *
+ * @param {packet_t *} packet The packet
+ * @param {int} field The field, one of the BAD_ constants
+ * @param {int} variant Which wrong value to use
+ */
+void corrupt_header(packet_t *packet, int field, int variant) {
+  switch (field) {
+    case BAD_MARKER:
+      packet->marker_byte = variant ? 0xff : MARKER_BYTE + 1;
+      break;
+    case BAD_VERSION:
+      packet->format_version = variant ? 0 : 2;
+      break;
+    case BAD_CB:
+      packet->cb_index = variant ? 0 : CB_INDEX + 1;
+      break;
+    case BAD_TAB:
+      packet->tab_index = variant ? 0xff : NTABS;
+      break;
+    case BAD_CHANNEL:
+      packet->channel_index = bswap_16(variant ? 0xffff : NCHANNELS);
+      break;
+    case BAD_SEQUENCE:
+      packet->sequence_number = variant ? 0xff : SEQUENCE_LENGTH;
+      break;
+    case BAD_PAYLOAD:
+      packet->payload_size = bswap_16(variant ? PAYLOADSIZE_STOKESIQUV : PAYLOADSIZE_STOKESI + 1);
+      break;
+  }
+}
+
+/**
+ * Compare a batch validation function with check_header
+ *
+ * @param {const char *} name Name of the validation function
+ * @param {header_check_t *} check Expected header values
+ * @param {packet_t **} packets The packets
+ * @param {int} npackets Number of packets
+ * @param {const char *} what Description of the batch, for the report
+ */
+void compare(const char *name, uint64_t (*validate)(const header_check_t *, packet_t * const *, int, unsigned long *, unsigned short *),
+    header_check_t *check, packet_t **packets, int npackets, const char *what) {
+  unsigned long timestamps[VALIDATE_BATCH];
+  unsigned short channels[VALIDATE_BATCH];
+  uint64_t valid, expected = 0;
+  int i;
+
+  for (i = 0; i < npackets; i++) {
+    if (check_header(check, packets[i]) < 0) {
+      expected |= 1UL << i;
+    }
+  }
+
+  valid = validate(check, packets, npackets, timestamps, channels);
+  if (valid != expected) {
+    fprintf(stderr, "FAIL %s, %s, %i packets: mask %016lx instead of %016lx\n", name, what, npackets, valid, expected);
+    failures++;
+    return;
+  }
+
+  for (i = 0; i < npackets; i++) {
+    if (!(valid >> i & 1)) {
+      continue;
+    }
+    if (timestamps[i] != bswap_64(packets[i]->timestamp) || channels[i] != bswap_16(packets[i]->channel_index)) {
+      fprintf(stderr, "FAIL %s, %s, %i packets: packet %i has timestamp %lu channel %u instead of %lu %u\n", name, what, npackets, i,
+          timestamps[i], channels[i], bswap_64(packets[i]->timestamp), bswap_16(packets[i]->channel_index));
+      failures++;
+      return;
+    }
+  }
+}
+
+/**
+ * Compare all batch validation functions supported by the CPU with check_header
+ */
+void compare_all(header_check_t *check, packet_t **packets, int npackets, const char *what) {
+  compare("scalar", validate_headers_scalar, check, packets, npackets, what);
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    compare("avx512", validate_headers_avx512, check, packets, npackets, what);
+  }
+}
+
+int main() {
+  static const char *fields[NFIELDS] = {"marker", "version", "cb", "tab", "channel", "sequence", "payload"};
+  packet_t *buffer = malloc(VALIDATE_BATCH * sizeof(packet_t));
+  packet_t *packets[VALIDATE_BATCH];
+  header_check_t check;
+  char what[64];
+  int npackets, field, variant, i;
+
+  header_check_init(&check, MARKER_BYTE, CB_INDEX, PAYLOADSIZE_STOKESI, NTABS, SEQUENCE_LENGTH);
+  if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw")) {
+    printf("No AVX-512 on this CPU, testing the scalar version only\n");
+  }
+
+  // packets out of order in memory, like the packet buffer after a few batches
+  for (i = 0; i < VALIDATE_BATCH; i++) {
+    packets[i] = &buffer[(5 * i) % VALIDATE_BATCH];
+  }
+
+  for (npackets = 1; npackets <= VALIDATE_BATCH; npackets++) {
+    for (i = 0; i < npackets; i++) {
+      valid_header(packets[i], i);
+    }
+    compare_all(&check, packets, npackets, "all valid");
+
+    // one field corrupted, on every third packet, so the bad packets move through the lanes
+    for (field = 0; field < NFIELDS; field++) {
+      for (variant = 0; variant < 2; variant++) {
+        for (i = 0; i < npackets; i++) {
+          valid_header(packets[i], i);
+          if ((i + field) % 3 == 0) {
+            corrupt_header(packets[i], field, variant);
+          }
+        }
+        snprintf(what, sizeof(what), "bad %s (%i)", fields[field], variant);
+        compare_all(&check, packets, npackets, what);
+      }
+    }
+
+    // a different field corrupted on each packet, and some packets with several bad fields
+    for (i = 0; i < npackets; i++) {
+      valid_header(packets[i], i);
+      if (i % 4 != 3) {
+        corrupt_header(packets[i], i % NFIELDS, i % 2);
+      }
+      if (i % 5 == 0) {
+        corrupt_header(packets[i], (i + 3) % NFIELDS, 0);
+      }
+    }
+    compare_all(&check, packets, npackets, "mixed");
+  }
+
+  free(buffer);
+
+  if (failures) {
+    fprintf(stderr, "%i failures\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("Batch validation agrees with check_header on batches of 1 to %i packets\n", VALIDATE_BATCH);
+  return EXIT_SUCCESS;
+}